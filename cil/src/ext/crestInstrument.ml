@@ -38,6 +38,11 @@ let concatMap f ls =
 let open_append fname =
   open_out_gen [Open_append; Open_creat; Open_text] 0o700 fname
 
+let rec mapIndexed f i ls =
+  match ls with
+    | [] -> []
+    | (x::xs) -> f i x :: mapIndexed f (i+1) xs
+
 
 (*
  * We maintain several bits of state while instrumenting a program:
@@ -197,6 +202,17 @@ let boolType = TInt (IUChar, [])
 let opType   = intType  (* enum *)
 
 
+(*
+ * With --crestBytecode, each expression is instrumented with a single
+ * call to __CrestEval, passing a descriptor of the expression (see
+ * "libcrest/crest.h") instead of a Load or Apply call per step.
+ *)
+let useBytecode = ref false
+
+(* With --crestPrune, expressions proven concrete are not instrumented. *)
+let usePruning = ref false
+
+
 (*
  * normalizeConditionalsVisitor ensures that every if block has an
  * accompanying else block (by adding empty "else { }" blocks where
@@ -272,6 +288,137 @@ let hasAddress (_, off) =
     not (containsBitField off)
 
 
+(*
+ * A flow-insensitive analysis of which variables may hold symbolic
+ * values, for --crestPrune.  Because CIL is run once per source file,
+ * it is conservative about anything outside the current file: every
+ * non-static global, every variable whose address is taken (which
+ * includes every variable passed to a CREST_* input function), every
+ * formal of a function which may be called from elsewhere, and every
+ * value returned from a function not defined in this file may be
+ * symbolic.  Symbolic values are then propagated through assignments,
+ * calls and returns until nothing changes.  Any memory read through a
+ * pointer may be symbolic.
+ *)
+let symbolicVars : (int, unit) Hashtbl.t = Hashtbl.create 256
+let symbolicReturns : (int, unit) Hashtbl.t = Hashtbl.create 64
+
+let isSymbolicVar v =
+  (v.vglob && v.vstorage <> Static) || Hashtbl.mem symbolicVars v.vid
+
+let rec isConcreteExpr e =
+  if isConstant e then
+    true
+  else
+    match e with
+      | Lval (Var v, _)          -> not (isSymbolicVar v)
+      | Lval (Mem _, _)          -> false
+      | UnOp (_, e, _)           -> isConcreteExpr e
+      | BinOp (_, e1, e2, _)     -> (isConcreteExpr e1) && (isConcreteExpr e2)
+      | CastE (_, e)             -> isConcreteExpr e
+      | AddrOf _ | StartOf _     -> true
+      | _                        -> false
+
+class addressTakenVisitor =
+object
+  inherit nopCilVisitor
+
+  method vexpr e =
+    (match e with
+       | AddrOf (Var v, _) | StartOf (Var v, _) ->
+           Hashtbl.replace symbolicVars v.vid ()
+       | _ -> ()) ;
+    DoChildren
+end
+
+class taintVisitor (defined : (int, fundec) Hashtbl.t) (changed : bool ref) =
+  let mark v =
+    if not (isSymbolicVar v) then
+      (Hashtbl.replace symbolicVars v.vid () ; changed := true)
+  in
+  let markLval lv =
+    match lv with
+      | (Var v, _) -> mark v
+      | (Mem _, _) -> ()  (* Only address-taken variables are reachable. *)
+  in
+object
+  inherit nopCilVisitor
+
+  val mutable curFunc = None
+
+  method vfunc fd =
+    curFunc <- Some fd ;
+    DoChildren
+
+  method vinst i =
+    (match i with
+       | Set (lv, e, _) ->
+           if not (isConcreteExpr e) then markLval lv
+
+       | Call (ret, Lval (Var fv, NoOffset), args, _)
+           when Hashtbl.mem defined fv.vid ->
+           let fd = Hashtbl.find defined fv.vid in
+           let rec markArgs formals args =
+             match (formals, args) with
+               | (v :: vs, e :: es) ->
+                   if not (isConcreteExpr e) then mark v ;
+                   markArgs vs es
+               | _ -> ()
+           in
+             markArgs fd.sformals args ;
+             (match ret with
+                | Some lv when Hashtbl.mem symbolicReturns fv.vid -> markLval lv
+                | _ -> ())
+
+       | Call (Some lv, _, _, _) -> markLval lv
+
+       | _ -> ()) ;
+    SkipChildren
+
+  method vstmt s =
+    (match (s.skind, curFunc) with
+       | (Return (Some e, _), Some fd) ->
+           if (not (isConcreteExpr e))
+              && (not (Hashtbl.mem symbolicReturns fd.svar.vid)) then
+             (Hashtbl.replace symbolicReturns fd.svar.vid () ; changed := true)
+       | _ -> ()) ;
+    DoChildren
+end
+
+let computeSymbolicVars f =
+  let defined = Hashtbl.create 64 in
+  let seedFunction glob =
+    match glob with
+      | GFun (fd, _) ->
+          let (_, _, isVarArgs, _) = splitFunctionType fd.svar.vtype in
+            Hashtbl.replace defined fd.svar.vid fd ;
+            if (fd.svar.vstorage <> Static) || isVarArgs then
+              List.iter (fun v -> Hashtbl.replace symbolicVars v.vid ()) fd.sformals
+      | _ -> ()
+  in
+  let changed = ref true in
+    Hashtbl.clear symbolicVars ;
+    Hashtbl.clear symbolicReturns ;
+    iterGlobals f seedFunction ;
+    visitCilFileSameGlobals (new addressTakenVisitor :> cilVisitor) f ;
+    (* A function whose address is taken may be called from anywhere. *)
+    Hashtbl.iter
+      (fun vid fd ->
+         if Hashtbl.mem symbolicVars vid then
+           List.iter (fun v -> Hashtbl.replace symbolicVars v.vid ()) fd.sformals)
+      defined ;
+    while !changed do
+      changed := false ;
+      visitCilFileSameGlobals (new taintVisitor defined changed :> cilVisitor) f
+    done
+
+
+(* The number of instrumentation calls inserted, and of those pruned (as
+ * calls, or as steps of an expression descriptor). *)
+let numHooks = ref 0
+let numPrunedHooks = ref 0
+
+
 class crestInstrumentVisitor f =
   (*
    * Get handles to the instrumentation functions.
@@ -296,46 +443,66 @@ class crestInstrumentVisitor f =
       func
   in
 
-  let loadFunc         = mkInstFunc "Load"  [addrArg; valArg] in
-  let storeFunc        = mkInstFunc "Store" [addrArg] in
-  let clearStackFunc   = mkInstFunc "ClearStack" [] in
-  let apply1Func       = mkInstFunc "Apply1" [opArg; valArg] in
-  let apply2Func       = mkInstFunc "Apply2" [opArg; valArg] in
+  (*
+   * Calls which do nothing until the first symbolic input go through the
+   * inline guards in "crest.h", if the file defines them.
+   *)
+  let mkGuardedInstFunc name args =
+    let guardName = "__Crest" ^ name ^ "Guard" in
+    let isGuard glob =
+      match glob with
+        | GFun (fd, _) -> fd.svar.vname = guardName
+        | _ -> false
+    in
+      try
+        (match List.find isGuard f.globals with
+           | GFun (fd, _) -> fd.svar
+           | _ -> raise Not_found)
+      with Not_found -> mkInstFunc name args
+  in
+
+  let loadFunc         = mkGuardedInstFunc "Load"  [addrArg; valArg] in
+  let storeFunc        = mkGuardedInstFunc "Store" [addrArg] in
+  let clearStackFunc   = mkGuardedInstFunc "ClearStack" [] in
+  let apply1Func       = mkGuardedInstFunc "Apply1" [opArg; valArg] in
+  let apply2Func       = mkGuardedInstFunc "Apply2" [opArg; valArg] in
   let branchFunc       = mkInstFunc "Branch" [bidArg; boolArg] in
   let callFunc         = mkInstFunc "Call" [fidArg] in
   let returnFunc       = mkInstFunc "Return" [] in
-  let handleReturnFunc = mkInstFunc "HandleReturn" [valArg] in
+  let handleReturnFunc = mkGuardedInstFunc "HandleReturn" [valArg] in
+  let evalFunc         = mkGuardedInstFunc "Eval"
+                           [("code",  charConstPtrType,   []);
+                            ("addrs", TPtr (addrType, []), []);
+                            ("vals",  TPtr (valType, []),  [])] in
 
   (*
    * Functions to create calls to the above instrumentation functions.
    *)
   let mkInstCall func args =
     let args' = integer (getNewId ()) :: args in
+      incr numHooks ;
       Call (None, Lval (var func), args', locUnknown)
   in
 
-  let unaryOpCode op =
-    let c =
-      match op with
-        | Neg -> 19  | BNot -> 20  |  LNot -> 21
-    in
-      integer c
+  let unaryOpNum op =
+    match op with
+      | Neg -> 19  | BNot -> 20  |  LNot -> 21
   in
 
-  let binaryOpCode op =
-    let c =
-      match op with
-        | PlusA   ->  0  | MinusA  ->  1  | Mult  ->  2  | Div   ->  3
-        | Mod     ->  4  | BAnd    ->  5  | BOr   ->  6  | BXor  ->  7
-        | Shiftlt ->  8  | Shiftrt ->  9  | LAnd  -> 10  | LOr   -> 11
-        | Eq      -> 12  | Ne      -> 13  | Gt    -> 14  | Le    -> 15
-        | Lt      -> 16  | Ge      -> 17
-            (* Other/unhandled operators discarded and treated concretely. *)
-        | _ -> 18
-    in
-      integer c
+  let binaryOpNum op =
+    match op with
+      | PlusA   ->  0  | MinusA  ->  1  | Mult  ->  2  | Div   ->  3
+      | Mod     ->  4  | BAnd    ->  5  | BOr   ->  6  | BXor  ->  7
+      | Shiftlt ->  8  | Shiftrt ->  9  | LAnd  -> 10  | LOr   -> 11
+      | Eq      -> 12  | Ne      -> 13  | Gt    -> 14  | Le    -> 15
+      | Lt      -> 16  | Ge      -> 17
+          (* Other/unhandled operators discarded and treated concretely. *)
+      | _ -> 18
   in
 
+  let unaryOpCode op = integer (unaryOpNum op) in
+  let binaryOpCode op = integer (binaryOpNum op) in
+
   let toAddr e = CastE (addrType, e) in
 
   let toValue e =
@@ -356,11 +523,32 @@ class crestInstrumentVisitor f =
   let mkHandleReturn value = mkInstCall handleReturnFunc [toValue value] in
 
 
+  (* The number of Load and Apply calls for an unpruned expression. *)
+  let rec countSteps e =
+    match e with
+      | _ when isConstant e -> 1
+      | Lval lv when hasAddress lv -> 1
+      | UnOp (_, e, _) -> 1 + countSteps e
+      | BinOp (_, e1, e2, _) -> 1 + (countSteps e1) + (countSteps e2)
+      | CastE (_, e) -> countSteps e
+      | _ -> 1
+  in
+
+  (* Is the expression (proven) concrete, and not worth instrumenting
+   * beyond a single concrete load? *)
+  let isPruned e =
+    if (not !usePruning) || (isConstant e) || (not (isConcreteExpr e)) then
+      false
+    else
+      (numPrunedHooks := !numPrunedHooks + (countSteps e) - 1 ;
+       true)
+  in
+
   (*
    * Instrument an expression.
    *)
   let rec instrumentExpr e =
-    if isConstant e then
+    if (isConstant e) || (isPruned e) then
       [mkLoad noAddr e]
     else
       match e with
@@ -385,6 +573,82 @@ class crestInstrumentVisitor f =
   in
 
 
+  (*
+   * Compile an expression, in the same postfix order as instrumentExpr,
+   * into a descriptor plus the addresses and values it consumes.  (The
+   * steps are built in reverse.)
+   *)
+  let applyStep n = String.make 1 (Char.chr (Char.code 'A' + n)) in
+
+  let rec compileExpr (steps, addrs, vals) e =
+    if (isConstant e) || (isPruned e) then
+      ("c" :: steps, addrs, e :: vals)
+    else
+      match e with
+        | Lval lv when hasAddress lv ->
+            ("l" :: steps, addressOf lv :: addrs, e :: vals)
+
+        | UnOp (op, e', _) ->
+            let (steps, addrs, vals) = compileExpr (steps, addrs, vals) e' in
+              (applyStep (unaryOpNum op) :: steps, addrs, e :: vals)
+
+        | BinOp (op, e1, e2, _) ->
+            let acc = compileExpr (compileExpr (steps, addrs, vals) e1) e2 in
+            let (steps, addrs, vals) = acc in
+              (applyStep (binaryOpNum op) :: steps, addrs, e :: vals)
+
+        | CastE (_, e') -> compileExpr (steps, addrs, vals) e'
+
+        | _ -> ("c" :: steps, addrs, e :: vals)
+  in
+
+  (*
+   * The arrays, local to the function being instrumented, in which the
+   * addresses and values for __CrestEval are passed.  They are sized
+   * once the whole function has been instrumented.
+   *)
+  let evalBufs = ref None in
+  let maxAddrs = ref 0 in
+  let maxVals = ref 0 in
+
+  let fillBuf buf conv es =
+    let setElem i e =
+      Set ((Var buf, Index (integer i, NoOffset)), conv e, locUnknown)
+    in
+      mapIndexed setElem 0 es
+  in
+
+  let bytecodeExprs es =
+    match (es, !evalBufs) with
+      | ([], _) -> []
+      | (_, None) -> concatMap instrumentExpr es
+      | (_, Some (addrBuf, valBuf)) ->
+          let (steps, addrs, vals) = List.fold_left compileExpr ([], [], []) es in
+          let (addrs, vals) = (List.rev addrs, List.rev vals) in
+          let bufArg buf ty es =
+            if es = [] then CastE (TPtr (ty, []), zero) else mkAddrOrStartOf (var buf)
+          in
+          let code = String.concat "" (List.rev steps) in
+            numHooks := !numHooks + (List.length steps) - 1 ;
+            maxAddrs := max !maxAddrs (List.length addrs) ;
+            maxVals := max !maxVals (List.length vals) ;
+            (fillBuf addrBuf toAddr addrs)
+            @ (fillBuf valBuf toValue vals)
+            @ [mkInstCall evalFunc [mkString code;
+                                    bufArg addrBuf addrType addrs;
+                                    bufArg valBuf valType vals]]
+  in
+
+  (* Instrument a sequence of expressions, whose values are left on the
+   * stack in order. *)
+  let instrumentExprs es =
+    if !useBytecode then
+      bytecodeExprs es
+    else
+      concatMap instrumentExpr es
+  in
+
+
 object (self)
   inherit nopCilVisitor
 
@@ -398,7 +662,7 @@ object (self)
           let getFirstStmtId blk = (List.hd blk.bstmts).sid in
           let b1_sid = getFirstStmtId b1 in
           let b2_sid = getFirstStmtId b2 in
-	    (self#queueInstr (instrumentExpr e) ;
+	    (self#queueInstr (instrumentExprs [e]) ;
 	     prependToBlock [mkBranch b1_sid 1] b1 ;
 	     prependToBlock [mkBranch b2_sid 0] b2 ;
              addBranchPair (b1_sid, b2_sid)) ;
@@ -406,7 +670,7 @@ object (self)
 
       | Return (Some e, _) ->
           if isSymbolicType (typeOf e) then
-            self#queueInstr (instrumentExpr e) ;
+            self#queueInstr (instrumentExprs [e]) ;
           self#queueInstr [mkReturn ()] ;
           SkipChildren
 
@@ -422,9 +686,16 @@ object (self)
    *)
   method vinst(i) =
     match i with
+      | Set ((Var v, _) as lv, e, _)
+          when !usePruning && (not (isSymbolicVar v))
+               && (isSymbolicType (typeOf e)) && (hasAddress lv) ->
+          (* Both the value and the variable are concrete. *)
+          numPrunedHooks := !numPrunedHooks + (countSteps e) + 1 ;
+          SkipChildren
+
       | Set (lv, e, _) ->
           if (isSymbolicType (typeOf e)) && (hasAddress lv) then
-            (self#queueInstr (instrumentExpr e) ;
+            (self#queueInstr (instrumentExprs [e]) ;
              self#queueInstr [mkStore (addressOf lv)]) ;
           SkipChildren
 
@@ -436,8 +707,14 @@ object (self)
           let isSymbolicExp e = isSymbolicType (typeOf e) in
           let isSymbolicLval lv = isSymbolicType (typeOfLval lv) in
           let argsToInst = List.filter isSymbolicExp args in
-            self#queueInstr (concatMap instrumentExpr argsToInst) ;
+            self#queueInstr (instrumentExprs argsToInst) ;
             (match ret with
+               | Some ((Var v, _) as lv)
+                   when !usePruning && (not (isSymbolicVar v))
+                        && (isSymbolicLval lv) && (hasAddress lv) ->
+                   (* A concrete result, so just clean up the stack. *)
+                   numPrunedHooks := !numPrunedHooks + 1 ;
+                   ChangeTo [i ; mkClearStack ()]
                | Some lv when ((isSymbolicLval lv) && (hasAddress lv)) ->
                    ChangeTo [i ;
                              mkHandleReturn (Lval lv) ;
@@ -463,7 +740,25 @@ object (self)
         if (not isVarArgs) then
           prependToBlock (List.rev_map instParam paramsToInst) f.sbody ;
         prependToBlock [mkCall !funCount] f.sbody ;
-        DoChildren
+        if !useBytecode then
+          (let arrayOf ty n = TArray (ty, Some (integer (max n 1)), []) in
+           let addrBuf = makeLocalVar f "__crest_addrs" (arrayOf addrType 1) in
+           let valBuf = makeLocalVar f "__crest_vals" (arrayOf valType 1) in
+           let sizeBufs f =
+             addrBuf.vtype <- arrayOf addrType !maxAddrs ;
+             valBuf.vtype <- arrayOf valType !maxVals ;
+             if !maxVals = 0 then
+               f.slocals <- List.filter (fun v -> v != addrBuf && v != valBuf)
+                                        f.slocals ;
+             evalBufs := None ;
+             f
+           in
+             evalBufs := Some (addrBuf, valBuf) ;
+             maxAddrs := 0 ;
+             maxVals := 0 ;
+             ChangeDoChildrenPost (f, sizeBufs))
+        else
+          DoChildren
 
 end
 
@@ -488,7 +783,12 @@ let feature : featureDescr =
   { fd_name = "CrestInstrument";
     fd_enabled = ref false;
     fd_description = "instrument a program for use with CREST";
-    fd_extraopt = [];
+    fd_extraopt = [
+      ("--crestBytecode", Arg.Set useBytecode,
+       " Instrument each expression with one call, passing a descriptor");
+      ("--crestPrune", Arg.Set usePruning,
+       " Do not instrument expressions proven to be concrete");
+    ];
     fd_post_check = true;
     fd_doit =
       function (f: file) ->
@@ -520,11 +820,19 @@ let feature : featureDescr =
            * and by explicitly adding edges for calls to functions
            * defined in this file. *)
           handleCallEdgesAndWriteCfg f ;
+          (* Find the variables which may be symbolic, if pruning. *)
+          if !usePruning then computeSymbolicVars f ;
           (* Finally instrument the program. *)
 	  (let instVisitor = new crestInstrumentVisitor f in
              visitCilFileSameGlobals (instVisitor :> cilVisitor) f) ;
           (* Add a function to initialize the instrumentation library. *)
           addCrestInitializer f ;
+          if !usePruning then
+            (let total = !numHooks + !numPrunedHooks in
+               Printf.eprintf "Pruned %d of %d instrumentation calls (%.1f%%).\n"
+                 !numPrunedHooks total
+                 (if total = 0 then 0.0
+                  else 100.0 *. (float_of_int !numPrunedHooks) /. (float_of_int total))) ;
           (* Write the ID and statement counts, the branches. *)
           writeIdCount () ;
           writeStmtCount () ;
@@ -100,6 +100,9 @@
  * - A symbolic input generates a call to create a new symbol (passing
  *   the conrete initial value for that symbol).
  *
+ *   A symbolic buffer (CREST_bytes, CREST_array) generates a single call,
+ *   which creates one symbol per byte (with consecutive ID's).
+ *
  *   [We pass the conrete value and have signed/unsigned versions only
  *   to make it easier to exactly capture/print the concrete inputs to
  *   the program under test.]
@@ -127,6 +130,7 @@
 
 #define __CREST_OP int
 #define __CREST_BOOL unsigned char
+#define __CREST_SIZE unsigned long int
 
 /*
  * Constants representing possible C operators.
@@ -184,6 +188,102 @@ EXTERN void __CrestCall(__CREST_ID, __CREST_FUNCTION_ID) __SKIP;
 EXTERN void __CrestReturn(__CREST_ID) __SKIP;
 EXTERN void __CrestHandleReturn(__CREST_ID, __CREST_VALUE) __SKIP;
 
+/*
+ * Expression descriptors.
+ *
+ * When instrumenting with --crestBytecode, the series of Load and Apply
+ * calls for an expression (or for the arguments of a call, in order) is
+ * replaced with a single Eval call.  Eval is passed a static descriptor
+ * of the expression, in postfix, with one character per Load or Apply:
+ *
+ *    'l'       Load from the next address, with the next value
+ *    'c'       Load a constant (address 0), with the next value
+ *    'A' + op  Apply the unary or binary operator op, with the next value
+ *
+ * plus the arrays of addresses and of concrete values consumed, in order.
+ * For example, "a*b > 3+c" generates:
+ *     Eval("llCclAO", {&a, &b, &c}, {a, b, a*b, 3, c, 3+c, a*b > 3+c})
+ */
+#define __CREST_EXPR_LOAD   'l'
+#define __CREST_EXPR_CONST  'c'
+#define __CREST_EXPR_APPLY  'A'
+
+EXTERN void __CrestEval(__CREST_ID, const char*,
+                        const __CREST_ADDR*, const __CREST_VALUE*) __SKIP;
+
+/*
+ * Inline guards.
+ *
+ * Until the program under test reads its first symbolic input, the Load,
+ * Store, ClearStack, Apply, HandleReturn, and Eval calls do nothing.  So,
+ * in instrumented code which includes this file (crestc includes it in
+ * every file), these calls are made through the static inline wrappers
+ * below, which test __CrestPreSymbolic before calling into libcrest.
+ * (The pragma keeps CIL from removing the wrappers as unused before they
+ * are called.)  Define CREST_NO_INLINE_GUARDS to call libcrest directly.
+ */
+EXTERN int __CrestPreSymbolic;
+
+#if !defined(__cplusplus) && !defined(CREST_NO_INLINE_GUARDS)
+
+#ifdef CIL
+#pragma cilnoremove("__CrestLoadGuard", "__CrestStoreGuard")
+#pragma cilnoremove("__CrestClearStackGuard", "__CrestApply1Guard")
+#pragma cilnoremove("__CrestApply2Guard", "__CrestHandleReturnGuard")
+#pragma cilnoremove("__CrestEvalGuard")
+#endif
+
+static __inline__ void __CrestLoadGuard(__CREST_ID, __CREST_ADDR, __CREST_VALUE) __SKIP;
+static __inline__ void __CrestStoreGuard(__CREST_ID, __CREST_ADDR) __SKIP;
+static __inline__ void __CrestClearStackGuard(__CREST_ID) __SKIP;
+static __inline__ void __CrestApply1Guard(__CREST_ID, __CREST_OP, __CREST_VALUE) __SKIP;
+static __inline__ void __CrestApply2Guard(__CREST_ID, __CREST_OP, __CREST_VALUE) __SKIP;
+static __inline__ void __CrestHandleReturnGuard(__CREST_ID, __CREST_VALUE) __SKIP;
+static __inline__ void __CrestEvalGuard(__CREST_ID, const char*,
+                                    const __CREST_ADDR*, const __CREST_VALUE*) __SKIP;
+
+static __inline__ void __CrestLoadGuard(__CREST_ID id, __CREST_ADDR addr,
+                                    __CREST_VALUE val) {
+  if (!__CrestPreSymbolic)
+    __CrestLoad(id, addr, val);
+}
+
+static __inline__ void __CrestStoreGuard(__CREST_ID id, __CREST_ADDR addr) {
+  if (!__CrestPreSymbolic)
+    __CrestStore(id, addr);
+}
+
+static __inline__ void __CrestClearStackGuard(__CREST_ID id) {
+  if (!__CrestPreSymbolic)
+    __CrestClearStack(id);
+}
+
+static __inline__ void __CrestApply1Guard(__CREST_ID id, __CREST_OP op,
+                                      __CREST_VALUE val) {
+  if (!__CrestPreSymbolic)
+    __CrestApply1(id, op, val);
+}
+
+static __inline__ void __CrestApply2Guard(__CREST_ID id, __CREST_OP op,
+                                      __CREST_VALUE val) {
+  if (!__CrestPreSymbolic)
+    __CrestApply2(id, op, val);
+}
+
+static __inline__ void __CrestHandleReturnGuard(__CREST_ID id, __CREST_VALUE val) {
+  if (!__CrestPreSymbolic)
+    __CrestHandleReturn(id, val);
+}
+
+static __inline__ void __CrestEvalGuard(__CREST_ID id, const char* code,
+                                    const __CREST_ADDR* addrs,
+                                    const __CREST_VALUE* vals) {
+  if (!__CrestPreSymbolic)
+    __CrestEval(id, code, addrs, vals);
+}
+
+#endif  /* !__cplusplus && !CREST_NO_INLINE_GUARDS */
+
 /*
  * Functions (macros) for obtaining symbolic inputs.
  */
@@ -193,6 +293,8 @@ EXTERN void __CrestHandleReturn(__CREST_ID, __CREST_VALUE) __SKIP;
 #define CREST_char(x) __CrestChar(&x)
 #define CREST_short(x) __CrestShort(&x)
 #define CREST_int(x) __CrestInt(&x)
+#define CREST_bytes(x, n) __CrestBytes((unsigned char*)(x), (n))
+#define CREST_array(x) __CrestBytes((unsigned char*)(x), sizeof(x))
 
 EXTERN void __CrestUChar(unsigned char* x) __SKIP;
 EXTERN void __CrestUShort(unsigned short* x) __SKIP;
@@ -200,5 +302,6 @@ EXTERN void __CrestUInt(unsigned int* x) __SKIP;
 EXTERN void __CrestChar(char* x) __SKIP;
 EXTERN void __CrestShort(short* x) __SKIP;
 EXTERN void __CrestInt(int* x) __SKIP;
+EXTERN void __CrestBytes(unsigned char* x, __CREST_SIZE n) __SKIP;
 
 #endif  /* LIBCREST_CREST_H__ */
@@ -0,0 +1,143 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "base/input_file.h"
+
+namespace crest {
+
+const char kInputFileMagic[8] = { 'C', 'R', 'E', 'S', 'T', 'I', 'N', '1' };
+
+
+bool WriteInputFile(const string& file, const vector<value_t>& input,
+                    bool text) {
+  if (text) {
+    FILE* f = fopen(file.c_str(), "w");
+    if (!f)
+      return false;
+    for (size_t i = 0; i < input.size(); i++) {
+      fprintf(f, "%lld\n", input[i]);
+    }
+    return (fclose(f) == 0);
+  }
+
+  int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  InputFileHeader header;
+  memcpy(header.magic, kInputFileMagic, sizeof(header.magic));
+  header.count = input.size();
+
+  struct iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<value_t*>(input.empty() ? NULL : &input.front());
+  iov[1].iov_len = input.size() * sizeof(value_t);
+
+  ssize_t len = iov[0].iov_len + iov[1].iov_len;
+  bool ok = (writev(fd, iov, 2) == len);
+  return (close(fd) == 0) && ok;
+}
+
+
+InputFile::InputFile()
+  : map_(NULL), map_len_(0), values_(NULL), size_(0) { }
+
+InputFile::~InputFile() {
+  Close();
+}
+
+void InputFile::Close() {
+  if (map_)
+    munmap(map_, map_len_);
+  map_ = NULL;
+  map_len_ = 0;
+  text_values_.clear();
+  values_ = NULL;
+  size_ = 0;
+}
+
+bool InputFile::Open(const string& file) {
+  Close();
+
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // Check for the binary format.
+  InputFileHeader header;
+  if ((static_cast<size_t>(st.st_size) >= sizeof(header))
+      && (pread(fd, &header, sizeof(header), 0) == sizeof(header))
+      && !memcmp(header.magic, kInputFileMagic, sizeof(header.magic))) {
+    // Check the count against the file size before multiplying, so a
+    // corrupt count cannot overflow.
+    if (header.count
+        > (static_cast<size_t>(st.st_size) - sizeof(header)) / sizeof(value_t)) {
+      close(fd);
+      return false;
+    }
+    size_t len = sizeof(header) + header.count * sizeof(value_t);
+    if (header.count > 0) {
+      void* p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      map_ = p;
+      map_len_ = len;
+      values_ = reinterpret_cast<const value_t*>
+        (static_cast<const char*>(p) + sizeof(header));
+      size_ = header.count;
+    }
+    close(fd);
+    return true;
+  }
+
+  // Otherwise, parse the text format.
+  FILE* f = fdopen(fd, "r");
+  if (!f) {
+    close(fd);
+    return false;
+  }
+  value_t val;
+  while (fscanf(f, "%lld", &val) == 1) {
+    text_values_.push_back(val);
+  }
+  fclose(f);
+  if (!text_values_.empty())
+    values_ = &text_values_.front();
+  size_ = text_values_.size();
+  return true;
+}
+
+
+bool ReadInputFile(const string& file, vector<value_t>* input) {
+  InputFile in;
+  if (!in.Open(file))
+    return false;
+  input->assign(in.values(), in.values() + in.size());
+  return true;
+}
+
+}  // namespace crest
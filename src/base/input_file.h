@@ -0,0 +1,74 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef BASE_INPUT_FILE_H__
+#define BASE_INPUT_FILE_H__
+
+#include <string>
+#include <vector>
+
+#include "base/basic_types.h"
+
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// The inputs for a run of the program under test are passed in a file
+// in one of two formats:
+//  - binary: an InputFileHeader followed by 'count' value_t's, or
+//  - text: one value per line (for debugging).
+// Readers detect the format from the magic string.
+struct InputFileHeader {
+  char magic[8];
+  unsigned long long count;
+};
+
+extern const char kInputFileMagic[8];
+
+// Writes 'input' to 'file' (with a single write in the binary format).
+bool WriteInputFile(const string& file, const vector<value_t>& input,
+                    bool text);
+
+// A read-only view of the values in an input file.  Binary files are
+// mapped into memory and read in place; text files are parsed.
+class InputFile {
+ public:
+  InputFile();
+  ~InputFile();
+
+  // Returns false if the file could not be opened or is malformed, in
+  // which case the view is empty.
+  bool Open(const string& file);
+
+  const value_t* values() const { return values_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* map_;
+  size_t map_len_;
+  vector<value_t> text_values_;
+
+  const value_t* values_;
+  size_t size_;
+
+  void Close();
+
+  // Not copyable.
+  InputFile(const InputFile&);
+  InputFile& operator=(const InputFile&);
+};
+
+// Reads all values from an input file in either format.
+bool ReadInputFile(const string& file, vector<value_t>* input);
+
+}  // namespace crest
+
+#endif  // BASE_INPUT_FILE_H__
@@ -0,0 +1,270 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "base/program_bundle.h"
+
+using std::ifstream;
+using std::ios;
+using std::max;
+using std::ofstream;
+using std::sort;
+using std::vector;
+
+namespace crest {
+
+namespace {
+
+const char kBundleMagic[4] = { 'C', 'P', 'B', '1' };
+
+template <typename T>
+void AppendArray(string* s, const vector<T>& v) {
+  if (!v.empty())
+    s->append(reinterpret_cast<const char*>(&v.front()), v.size() * sizeof(T));
+}
+
+// Appends the CSR form of the given adjacency lists.
+void AppendGraph(string* s, const vector< vector<branch_id_t> >& g) {
+  vector<unsigned> offsets(g.size() + 1, 0);
+  vector<branch_id_t> nbhrs;
+  for (size_t i = 0; i < g.size(); i++) {
+    nbhrs.insert(nbhrs.end(), g[i].begin(), g[i].end());
+    offsets[i+1] = nbhrs.size();
+  }
+  AppendArray(s, offsets);
+  AppendArray(s, nbhrs);
+}
+
+bool ModTime(const string& file, time_t* t) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0)
+    return false;
+  *t = st.st_mtime;
+  return true;
+}
+
+}  // namespace
+
+
+ProgramBundle::ProgramBundle() : map_(NULL), map_size_(0), header_(NULL) { }
+
+ProgramBundle::~ProgramBundle() {
+  Close();
+}
+
+
+void ProgramBundle::Close() {
+  if (map_ != NULL)
+    munmap(map_, map_size_);
+  map_ = NULL;
+  map_size_ = 0;
+  owned_.clear();
+  header_ = NULL;
+}
+
+
+bool ProgramBundle::Open(const string& bundle_file,
+                         const string& branches_file,
+                         const string& cfg_branches_file) {
+  Close();
+
+  // Use the bundle only if it is at least as new as the text files.
+  time_t bundle_time = 0, branches_time = 0, cfg_time = 0;
+  const bool has_text_cfg = ModTime(cfg_branches_file, &cfg_time);
+  if (ModTime(bundle_file, &bundle_time)
+      && ModTime(branches_file, &branches_time)
+      && (bundle_time >= branches_time)
+      && (!has_text_cfg || (bundle_time >= cfg_time))) {
+    int fd = open(bundle_file.c_str(), O_RDONLY);
+    struct stat st;
+    if ((fd != -1) && (fstat(fd, &st) == 0) && (st.st_size > 0)) {
+      void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mem != MAP_FAILED) {
+        map_ = mem;
+        map_size_ = st.st_size;
+        if (Attach(static_cast<const char*>(mem), st.st_size)) {
+          close(fd);
+          return true;
+        }
+        fprintf(stderr, "Ignoring malformed %s.\n", bundle_file.c_str());
+        Close();
+      }
+    }
+    if (fd != -1)
+      close(fd);
+  }
+
+  ifstream branches(branches_file.c_str());
+  if (!branches)
+    return false;
+  ifstream cfg_branches(cfg_branches_file.c_str(), ios::in | ios::binary);
+  return Build(branches, has_text_cfg ? &cfg_branches : NULL, &owned_)
+    && Attach(owned_.data(), owned_.size());
+}
+
+
+bool ProgramBundle::Attach(const char* data, size_t size) {
+  if ((size < sizeof(Header))
+      || !std::equal(kBundleMagic, kBundleMagic + sizeof(kBundleMagic), data))
+    return false;
+  const Header* h = reinterpret_cast<const Header*>(data);
+
+  const size_t words = static_cast<size_t>(h->num_branches)
+    + 2 * static_cast<size_t>(h->max_branch) + h->max_function
+    + 2 * (static_cast<size_t>(h->max_branch) + 1 + h->num_edges);
+  if (size != sizeof(Header) + words * 4)
+    return false;
+
+  header_ = h;
+  const char* p = data + sizeof(Header);
+  const branch_id_t* b = reinterpret_cast<const branch_id_t*>(p);
+  branches_ = ConstArray<branch_id_t>(b, h->num_branches);
+  b += h->num_branches;
+  paired_branch_ = ConstArray<branch_id_t>(b, h->max_branch);
+  b += h->max_branch;
+  const function_id_t* f = reinterpret_cast<const function_id_t*>(b);
+  branch_function_ = ConstArray<function_id_t>(f, h->max_branch);
+  f += h->max_branch;
+  const unsigned* u = reinterpret_cast<const unsigned*>(f);
+  branch_count_ = ConstArray<unsigned>(u, h->max_function);
+  u += h->max_function;
+  cfg_ = BranchGraph(u, reinterpret_cast<const branch_id_t*>(u + h->max_branch + 1),
+                     h->max_branch);
+  u += h->max_branch + 1 + h->num_edges;
+  cfg_rev_ = BranchGraph(u, reinterpret_cast<const branch_id_t*>(u + h->max_branch + 1),
+                         h->max_branch);
+  return true;
+}
+
+
+bool ProgramBundle::Build(istream& in, istream* cfg_in, string* out) {
+  // Read in the branches, function by function.
+  vector<branch_id_t> branches;
+  vector<unsigned> branch_count(1, 0);
+  branch_id_t max_branch = 0;
+  function_id_t fid;
+  int num_pairs;
+  while (in >> fid >> num_pairs) {
+    branch_count.push_back(2 * num_pairs);
+    for (int i = 0; i < num_pairs; i++) {
+      branch_id_t b1, b2;
+      if (!(in >> b1 >> b2) || (b1 < 0) || (b2 < 0))
+        return false;
+      branches.push_back(b1);
+      branches.push_back(b2);
+      max_branch = max(max_branch, max(b1, b2));
+    }
+  }
+  max_branch++;
+
+  vector<branch_id_t> paired_branch(max_branch, 0);
+  for (size_t i = 0; i < branches.size(); i += 2) {
+    paired_branch[branches[i]] = branches[i+1];
+    paired_branch[branches[i+1]] = branches[i];
+  }
+
+  vector<function_id_t> branch_function(max_branch, 0);
+  { size_t i = 0;
+    for (function_id_t j = 0; j < branch_count.size(); j++) {
+      for (size_t k = 0; k < branch_count[j]; k++) {
+        branch_function[branches[i++]] = j;
+      }
+    }
+  }
+
+  sort(branches.begin(), branches.end());
+
+  // Read in the thinned CFG, and reverse it.  (The sources of each
+  // reversed edge list are in increasing order.)
+  vector< vector<branch_id_t> > cfg(max_branch), cfg_rev(max_branch);
+  size_t num_edges = 0;
+  if (cfg_in != NULL) {
+    size_t num_branches;
+    if (!cfg_in->read((char*)&num_branches, sizeof(num_branches))
+        || (num_branches != branches.size()))
+      return false;
+    for (size_t i = 0; i < num_branches; i++) {
+      branch_id_t src;
+      size_t len;
+      if (!cfg_in->read((char*)&src, sizeof(src))
+          || !cfg_in->read((char*)&len, sizeof(len))
+          || (src < 0) || (src >= max_branch))
+        return false;
+      cfg[src].resize(len);
+      if ((len > 0)
+          && !cfg_in->read((char*)&cfg[src].front(), len * sizeof(branch_id_t)))
+        return false;
+    }
+    for (vector<branch_id_t>::const_iterator i = branches.begin();
+         i != branches.end(); ++i) {
+      for (vector<branch_id_t>::const_iterator j = cfg[*i].begin();
+           j != cfg[*i].end(); ++j) {
+        if ((*j < 0) || (*j >= max_branch))
+          return false;
+        cfg_rev[*j].push_back(*i);
+        num_edges++;
+      }
+    }
+
+    // Every source must be a branch (listed once).
+    size_t num_cfg_edges = 0;
+    for (size_t i = 0; i < cfg.size(); i++) {
+      num_cfg_edges += cfg[i].size();
+    }
+    if (num_cfg_edges != num_edges)
+      return false;
+  }
+
+  Header h;
+  std::copy(kBundleMagic, kBundleMagic + sizeof(kBundleMagic), h.magic);
+  h.max_branch = max_branch;
+  h.max_function = branch_count.size();
+  h.num_branches = branches.size();
+  h.num_edges = num_edges;
+  h.has_cfg = (cfg_in != NULL);
+
+  out->assign(reinterpret_cast<const char*>(&h), sizeof(h));
+  AppendArray(out, branches);
+  AppendArray(out, paired_branch);
+  AppendArray(out, branch_function);
+  AppendArray(out, branch_count);
+  AppendGraph(out, cfg);
+  AppendGraph(out, cfg_rev);
+  return true;
+}
+
+
+bool ProgramBundle::Write(const string& bundle_file,
+                          const string& branches_file,
+                          const string& cfg_branches_file) {
+  ifstream branches(branches_file.c_str());
+  ifstream cfg_branches(cfg_branches_file.c_str(), ios::in | ios::binary);
+  string s;
+  if (!branches || !cfg_branches || !Build(branches, &cfg_branches, &s))
+    return false;
+
+  // Write to a temporary file, so a reader never maps a partial bundle.
+  const string tmp = bundle_file + ".tmp";
+  { ofstream out(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out.write(s.data(), s.size()))
+      return false;
+  }
+  return rename(tmp.c_str(), bundle_file.c_str()) == 0;
+}
+
+}  // namespace crest
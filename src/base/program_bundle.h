@@ -0,0 +1,152 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef BASE_PROGRAM_BUNDLE_H__
+#define BASE_PROGRAM_BUNDLE_H__
+
+#include <istream>
+#include <string>
+
+#include "base/basic_types.h"
+
+using std::istream;
+using std::string;
+
+namespace crest {
+
+// A read-only view of an array, e.g. of a table in a bundle.
+template <typename T>
+class ConstArray {
+ public:
+  typedef const T* const_iterator;
+
+  ConstArray() : p_(NULL), n_(0) { }
+  ConstArray(const T* p, size_t n) : p_(p), n_(n) { }
+
+  const_iterator begin() const { return p_; }
+  const_iterator end() const { return p_ + n_; }
+  size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+  const T& operator[](size_t i) const { return p_[i]; }
+
+ private:
+  const T* p_;
+  size_t n_;
+};
+
+
+// A graph over branches, in compressed sparse row form: the neighbors
+// of branch b are nbhrs[offsets[b]] up to nbhrs[offsets[b+1]].
+class BranchGraph {
+ public:
+  BranchGraph() : offsets_(NULL), nbhrs_(NULL), size_(0) { }
+  BranchGraph(const unsigned* offsets, const branch_id_t* nbhrs, size_t size)
+    : offsets_(offsets), nbhrs_(nbhrs), size_(size) { }
+
+  ConstArray<branch_id_t> operator[](branch_id_t b) const {
+    return ConstArray<branch_id_t>(nbhrs_ + offsets_[b],
+                                   offsets_[b+1] - offsets_[b]);
+  }
+
+  // The number of nodes (i.e. one more than the largest branch id).
+  size_t size() const { return size_; }
+
+ private:
+  const unsigned* offsets_;
+  const branch_id_t* nbhrs_;
+  size_t size_;
+};
+
+
+// The static metadata about an instrumented program which run_crest
+// needs -- its branches, the pairing of the true and false branches,
+// the function each branch is in, and the thinned branch CFG and its
+// reverse -- laid out as flat tables in a single "program_bundle" file.
+//
+// process_cfg writes the bundle after thinning the CFG, and run_crest
+// maps it into memory and uses it in place, rather than parsing
+// "branches" and "cfg_branches" and building per-branch vectors (and
+// every worker process shares the same pages).  If the bundle is
+// missing, or older than either text file, it is built in memory from
+// the text files instead.
+class ProgramBundle {
+ public:
+  ProgramBundle();
+  ~ProgramBundle();
+
+  // Opens the bundle, falling back to building it from the text files.
+  // (The cfg_branches file may be absent, in which case the bundle has
+  // no CFG.)  Returns false if neither could be read.
+  bool Open(const string& bundle_file, const string& branches_file,
+            const string& cfg_branches_file);
+
+  // Builds a bundle from the contents of "branches" and, if given,
+  // "cfg_branches".  Returns false if either is malformed.
+  static bool Build(istream& branches, istream* cfg_branches, string* out);
+
+  // Writes a bundle built from the text files.
+  static bool Write(const string& bundle_file, const string& branches_file,
+                    const string& cfg_branches_file);
+
+  // One more than the largest branch id, and the number of functions
+  // (including the unused function id zero).
+  branch_id_t max_branch() const { return header_->max_branch; }
+  function_id_t max_function() const { return header_->max_function; }
+
+  // All branches, in increasing order.
+  const ConstArray<branch_id_t>& branches() const { return branches_; }
+
+  // Indexed by branch id.
+  const ConstArray<branch_id_t>& paired_branch() const { return paired_branch_; }
+  const ConstArray<function_id_t>& branch_function() const { return branch_function_; }
+
+  // The number of branches in each function.
+  const ConstArray<unsigned>& branch_count() const { return branch_count_; }
+
+  bool has_cfg() const { return header_->has_cfg != 0; }
+  const BranchGraph& cfg() const { return cfg_; }
+  const BranchGraph& cfg_rev() const { return cfg_rev_; }
+
+  bool mapped() const { return map_ != NULL; }
+
+ private:
+  struct Header {
+    char magic[4];
+    unsigned max_branch;
+    unsigned max_function;
+    unsigned num_branches;
+    unsigned num_edges;
+    unsigned has_cfg;
+  };
+
+  // Points the tables into the given bundle, checking its size.
+  bool Attach(const char* data, size_t size);
+  void Close();
+
+  void* map_;
+  size_t map_size_;
+  string owned_;  // The bundle, when built in memory.
+
+  const Header* header_;
+  ConstArray<branch_id_t> branches_;
+  ConstArray<branch_id_t> paired_branch_;
+  ConstArray<function_id_t> branch_function_;
+  ConstArray<unsigned> branch_count_;
+  BranchGraph cfg_;
+  BranchGraph cfg_rev_;
+
+  // Not copyable.
+  ProgramBundle(const ProgramBundle&);
+  ProgramBundle& operator=(const ProgramBundle&);
+};
+
+}  // namespace crest
+
+#endif  // BASE_PROGRAM_BUNDLE_H__
@@ -0,0 +1,124 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef BASE_SEGMENTED_BUFFER_H__
+#define BASE_SEGMENTED_BUFFER_H__
+
+#include <algorithm>
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <vector>
+
+using std::vector;
+
+namespace crest {
+
+// An append-only buffer stored as a list of chunks which are allocated
+// only when needed.  Unlike a vector, the buffer never copies elements
+// when it grows, and it does not touch memory it has not yet used.
+//
+// Chunk sizes start at one page and double up to kMaxChunkBytes.  Full
+// size chunks are aligned to, and advised as, huge pages (where the OS
+// supports transparent huge pages), so only very long runs pay for the
+// large allocations.
+//
+// T must be a POD type.
+template <typename T>
+class SegmentedBuffer {
+ public:
+  static const size_t kMinChunkBytes = 1 << 12;
+  static const size_t kMaxChunkBytes = 1 << 21;
+
+  SegmentedBuffer() : size_(0), next_(NULL), end_(NULL) { }
+  ~SegmentedBuffer() { Clear(); }
+
+  void push_back(const T& x) {
+    if (next_ == end_)
+      Grow();
+    *next_++ = x;
+    size_++;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Chunk-wise access to the contents, in order.
+  size_t num_chunks() const { return chunks_.size(); }
+  const T* chunk(size_t i) const { return chunks_[i].data; }
+  size_t chunk_size(size_t i) const {
+    if (i + 1 < chunks_.size())
+      return chunks_[i].capacity;
+    return next_ - chunks_[i].data;
+  }
+
+  void Swap(SegmentedBuffer& b) {
+    chunks_.swap(b.chunks_);
+    std::swap(size_, b.size_);
+    std::swap(next_, b.next_);
+    std::swap(end_, b.end_);
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < chunks_.size(); i++)
+      free(chunks_[i].data);
+    chunks_.clear();
+    size_ = 0;
+    next_ = end_ = NULL;
+  }
+
+ private:
+  struct Chunk {
+    T* data;
+    size_t capacity;
+  };
+
+  vector<Chunk> chunks_;
+  size_t size_;
+  T* next_;
+  T* end_;
+
+  void Grow() {
+    size_t bytes = kMinChunkBytes;
+    if (!chunks_.empty()) {
+      bytes = 2 * chunks_.back().capacity * sizeof(T);
+      if (bytes > kMaxChunkBytes)
+        bytes = kMaxChunkBytes;
+    }
+
+    Chunk c;
+    c.capacity = bytes / sizeof(T);
+    if (bytes == kMaxChunkBytes) {
+      void* p = NULL;
+      if (posix_memalign(&p, kMaxChunkBytes, bytes) != 0)
+        p = NULL;
+      c.data = static_cast<T*>(p);
+#ifdef MADV_HUGEPAGE
+      if (c.data)
+        madvise(c.data, bytes, MADV_HUGEPAGE);
+#endif
+    } else {
+      c.data = static_cast<T*>(malloc(bytes));
+    }
+    assert(c.data);
+
+    chunks_.push_back(c);
+    next_ = c.data;
+    end_ = c.data + c.capacity;
+  }
+
+  // Not copyable.
+  SegmentedBuffer(const SegmentedBuffer&);
+  SegmentedBuffer& operator=(const SegmentedBuffer&);
+};
+
+}  // namespace crest
+
+#endif  // BASE_SEGMENTED_BUFFER_H__
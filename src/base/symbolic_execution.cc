@@ -10,6 +10,7 @@
 
 #include <utility>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "base/symbolic_execution.h"
 
@@ -20,8 +21,8 @@ namespace crest {
 
 SymbolicExecution::SymbolicExecution() { }
 
-SymbolicExecution::SymbolicExecution(bool pre_allocate)
-  : path_(pre_allocate) { }
+SymbolicExecution::SymbolicExecution(bool record)
+  : path_(record) { }
 
 SymbolicExecution::~SymbolicExecution() { }
 
@@ -36,6 +37,10 @@ void SymbolicExecution::Serialize(string* s) const {
   char buf[32];
   size_t len = vars_.size();
 
+  /* path hash */
+  sprintf(buf, "%llu\n", path_.path_hash());
+  s->append(string(buf));
+
   /* #vars */
   sprintf(buf, "%d\n", len); // # of variables
   s->append(string(buf));
@@ -51,10 +56,13 @@ void SymbolicExecution::Serialize(string* s) const {
 }
 
 bool SymbolicExecution::Parse(istream& s) {
-  // Read the inputs.
   int len;
   char buf[MAX_LINE_BUF];
 
+  // Skip the path hash.  (The path recomputes it.)
+  s.getline(buf, MAX_LINE_BUF);
+
+  // Read the inputs.
   s.getline(buf, MAX_LINE_BUF);
   sscanf(buf, "%d\n", &len);
 
@@ -80,4 +88,11 @@ bool SymbolicExecution::Parse(istream& s) {
   return (path_.Parse(s) && !s.fail());
 }
 
+bool SymbolicExecution::ParsePathHash(const string& s, path_hash_t* hash) {
+  // (Not sscanf, which would scan the whole string for its length.)
+  char* end;
+  *hash = strtoull(s.c_str(), &end, 10);
+  return (end != s.c_str()) && (*end == '\n');
+}
+
 }  // namespace crest
@@ -29,13 +29,17 @@ namespace crest {
 class SymbolicExecution {
  public:
   SymbolicExecution();
-  explicit SymbolicExecution(bool pre_allocate);
+  explicit SymbolicExecution(bool record);
   ~SymbolicExecution();
 
   void Swap(SymbolicExecution& se);
 
+  // A serialized execution starts with the hash of its path, so that a
+  // reader can recognize a path it has already seen without parsing the
+  // rest.
   void Serialize(string* s) const;
   bool Parse(istream& s);
+  static bool ParsePathHash(const string& s, path_hash_t* hash);
 
   const map<var_t,type_t>& vars() const { return vars_; }
   const vector<value_t>& inputs() const { return inputs_; }
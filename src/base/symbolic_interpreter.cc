@@ -16,7 +16,9 @@
 
 #include "base/symbolic_interpreter.h"
 
+using std::copy;
 using std::make_pair;
+using std::min;
 using std::swap;
 using std::vector;
 
@@ -33,38 +35,68 @@ namespace crest {
 
 typedef map<addr_t,SymbolicExpr*>::const_iterator ConstMemIt;
 
+// Scoped lock on a pthread mutex.
+class MutexLock {
+ public:
+  explicit MutexLock(pthread_mutex_t* mu) : mu_(mu) { pthread_mutex_lock(mu_); }
+  ~MutexLock() { pthread_mutex_unlock(mu_); }
+ private:
+  pthread_mutex_t* mu_;
+};
+
+__thread SymbolicInterpreter::ThreadState*
+SymbolicInterpreter::current_thread_ = NULL;
+
 SymbolicInterpreter::SymbolicInterpreter()
-  : pred_(NULL), return_value_(false), ex_(true), num_inputs_(0) {
-  stack_.reserve(16);
+  : input_(NULL), input_size_(0),
+    ex_(true), num_inputs_(0), last_thread_(0) {
+  Init();
+}
+
+SymbolicInterpreter::SymbolicInterpreter(const value_t* input,
+                                         size_t input_size)
+  : input_(input), input_size_(input_size),
+    ex_(true), num_inputs_(0), last_thread_(0) {
+  Init();
 }
 
-SymbolicInterpreter::SymbolicInterpreter(const vector<value_t>& input)
-  : pred_(NULL), return_value_(false), ex_(true), num_inputs_(0) {
-  stack_.reserve(16);
-  ex_.mutable_inputs()->assign(input.begin(), input.end());
+void SymbolicInterpreter::Init() {
+  pthread_mutex_init(&lock_, NULL);
+  for (size_t i = 0; i < kNumMemShards; i++) {
+    pthread_mutex_init(&mem_[i].lock, NULL);
+  }
 }
 
 void SymbolicInterpreter::DumpMemory() {
-  for (ConstMemIt i = mem_.begin(); i != mem_.end(); ++i) {
-    string s;
-    i->second->AppendToString(&s);
-    fprintf(stderr, "%lu: %s [%d]\n", i->first, s.c_str(), *(int*)(i->first));
+  ThreadState* ts = CurrentThread();
+  const vector<StackElem>& stack = ts->stack;
+  const SymbolicPred* pred = ts->pred;
+  const bool return_value = ts->return_value;
+
+  for (size_t j = 0; j < kNumMemShards; j++) {
+    MutexLock l(&mem_[j].lock);
+    for (ConstMemIt i = mem_[j].mem.begin(); i != mem_[j].mem.end(); ++i) {
+      string s;
+      i->second->AppendToString(&s);
+      fprintf(stderr, "%lu: %s [%d]\n", i->first, s.c_str(), *(int*)(i->first));
+    }
   }
-  for (size_t i = 0; i < stack_.size(); i++) {
+  for (size_t i = 0; i < stack.size(); i++) {
     string s;
-    if (stack_[i].expr) {
-      stack_[i].expr->AppendToString(&s);
-    } else if ((i == stack_.size() - 1) && pred_) {
-      pred_->AppendToString(&s);
+    if (stack[i].expr) {
+      stack[i].expr->AppendToString(&s);
+    } else if ((i == stack.size() - 1) && pred) {
+      pred->AppendToString(&s);
     }
-    if ((i == (stack_.size() - 1)) && return_value_) {
-      fprintf(stderr, "s%d: %lld [ %s ] (RETURN VALUE)\n",
-	      i, stack_[i].concrete, s.c_str());
+    if ((i == (stack.size() - 1)) && return_value) {
+      fprintf(stderr, "t%u s%d: %lld [ %s ] (RETURN VALUE)\n",
+	      ts->id, i, stack[i].concrete, s.c_str());
     } else {
-      fprintf(stderr, "s%d: %lld [ %s ]\n", i, stack_[i].concrete, s.c_str());
+      fprintf(stderr, "t%u s%d: %lld [ %s ]\n",
+	      ts->id, i, stack[i].concrete, s.c_str());
     }
   }
-  if ((stack_.size() == 0) && return_value_) {
+  if ((stack.size() == 0) && return_value) {
     fprintf(stderr, "MISSING RETURN VALUE\n");
   }
 }
@@ -72,65 +104,76 @@ void SymbolicInterpreter::DumpMemory() {
 
 void SymbolicInterpreter::ClearStack(id_t id) {
   IFDEBUG(fprintf(stderr, "clear\n"));
-  for (vector<StackElem>::const_iterator it = stack_.begin(); it != stack_.end(); ++it) {
+  ThreadState* ts = CurrentThread();
+  for (vector<StackElem>::const_iterator it = ts->stack.begin(); it != ts->stack.end(); ++it) {
     delete it->expr;
   }
-  stack_.clear();
-  ClearPredicateRegister();
-  return_value_ = false;
+  ts->stack.clear();
+  ClearPredicateRegister(ts);
+  ts->return_value = false;
   IFDEBUG(DumpMemory());
 }
 
 
 void SymbolicInterpreter::Load(id_t id, addr_t addr, value_t value) {
   IFDEBUG(fprintf(stderr, "load %lu %lld\n", addr, value));
-  ConstMemIt it = mem_.find(addr);
-  if (it == mem_.end()) {
-    PushConcrete(value);
-  } else {
-    PushSymbolic(new SymbolicExpr(*it->second), value);
+  ThreadState* ts = CurrentThread();
+  SymbolicExpr* expr = NULL;
+  if (addr) {
+    MemShard& shard = ShardFor(addr);
+    MutexLock l(&shard.lock);
+    ConstMemIt it = shard.mem.find(addr);
+    if (it != shard.mem.end()) {
+      expr = new SymbolicExpr(*it->second);
+    }
   }
-  ClearPredicateRegister();
+  PushSymbolic(ts, expr, value);
+  ClearPredicateRegister(ts);
   IFDEBUG(DumpMemory());
 }
 
 
 void SymbolicInterpreter::Store(id_t id, addr_t addr) {
   IFDEBUG(fprintf(stderr, "store %lu\n", addr));
-  assert(stack_.size() > 0);
-
-  const StackElem& se = stack_.back();
-  if (se.expr) {
-    if (!se.expr->IsConcrete()) {
-      mem_[addr] = se.expr;
+  ThreadState* ts = CurrentThread();
+  assert(ts->stack.size() > 0);
+
+  const StackElem& se = ts->stack.back();
+  { MemShard& shard = ShardFor(addr);
+    MutexLock l(&shard.lock);
+    if (se.expr) {
+      if (!se.expr->IsConcrete()) {
+        shard.mem[addr] = se.expr;
+      } else {
+        shard.mem.erase(addr);
+        delete se.expr;
+      }
     } else {
-      mem_.erase(addr);
-      delete se.expr;
+      shard.mem.erase(addr);
     }
-  } else {
-    mem_.erase(addr);
   }
 
-  stack_.pop_back();
-  ClearPredicateRegister();
+  ts->stack.pop_back();
+  ClearPredicateRegister(ts);
   IFDEBUG(DumpMemory());
 }
 
 
 void SymbolicInterpreter::ApplyUnaryOp(id_t id, unary_op_t op, value_t value) {
   IFDEBUG(fprintf(stderr, "apply1 %d %lld\n", op, value));
-  assert(stack_.size() >= 1);
-  StackElem& se = stack_.back();
+  ThreadState* ts = CurrentThread();
+  assert(ts->stack.size() >= 1);
+  StackElem& se = ts->stack.back();
 
   if (se.expr) {
     switch (op) {
     case ops::NEGATE:
       se.expr->Negate();
-      ClearPredicateRegister();
+      ClearPredicateRegister(ts);
       break;
     case ops::LOGICAL_NOT:
-      if (pred_) {
-	pred_->Negate();
+      if (ts->pred) {
+	ts->pred->Negate();
 	break;
       }
       // Otherwise, fall through to the concrete case.
@@ -138,7 +181,7 @@ void SymbolicInterpreter::ApplyUnaryOp(id_t id, unary_op_t op, value_t value) {
       // Concrete operator.
       delete se.expr;
       se.expr = NULL;
-      ClearPredicateRegister();
+      ClearPredicateRegister(ts);
     }
   }
 
@@ -149,9 +192,10 @@ void SymbolicInterpreter::ApplyUnaryOp(id_t id, unary_op_t op, value_t value) {
 
 void SymbolicInterpreter::ApplyBinaryOp(id_t id, binary_op_t op, value_t value) {
   IFDEBUG(fprintf(stderr, "apply2 %d %lld\n", op, value));
-  assert(stack_.size() >= 2);
-  StackElem& a = *(stack_.rbegin()+1);
-  StackElem& b = stack_.back();
+  ThreadState* ts = CurrentThread();
+  assert(ts->stack.size() >= 2);
+  StackElem& a = *(ts->stack.rbegin()+1);
+  StackElem& b = ts->stack.back();
 
   char buf[MAX_LINE_BUF];
 
@@ -241,17 +285,18 @@ void SymbolicInterpreter::ApplyBinaryOp(id_t id, binary_op_t op, value_t value)
   }
 
   a.concrete = value;
-  stack_.pop_back();
-  ClearPredicateRegister();
+  ts->stack.pop_back();
+  ClearPredicateRegister(ts);
   IFDEBUG(DumpMemory());
 }
 
 
 void SymbolicInterpreter::ApplyCompareOp(id_t id, compare_op_t op, value_t value) {
   IFDEBUG(fprintf(stderr, "compare2 %d %lld\n", op, value));
-  assert(stack_.size() >= 2);
-  StackElem& a = *(stack_.rbegin()+1);
-  StackElem& b = stack_.back();
+  ThreadState* ts = CurrentThread();
+  assert(ts->stack.size() >= 2);
+  StackElem& a = *(ts->stack.rbegin()+1);
+  StackElem& b = ts->stack.back();
 
   if (a.expr || b.expr) {
     // Symbolically compute "a -= b".
@@ -268,12 +313,12 @@ void SymbolicInterpreter::ApplyCompareOp(id_t id, compare_op_t op, value_t value
     // Construct a symbolic predicate (if "a - b" is symbolic), and
     // store it in the predicate register.
     if (!a.expr->IsConcrete()) {
-      pred_ = new SymbolicPred(op, a.expr);
+      ts->pred = new SymbolicPred(op, a.expr);
       string s = "";
-      pred_->AppendToString(&s);
+      ts->pred->AppendToString(&s);
       IFDEBUG(fprintf(stderr, "ApplyCompareOp:newpred: %s\n", s.c_str()));
     } else {
-      ClearPredicateRegister();
+      ClearPredicateRegister(ts);
       delete a.expr;
     }
     // We leave a concrete value on the stack.
@@ -281,14 +326,14 @@ void SymbolicInterpreter::ApplyCompareOp(id_t id, compare_op_t op, value_t value
   }
 
   a.concrete = value;
-  stack_.pop_back();
+  ts->stack.pop_back();
   IFDEBUG(DumpMemory());
 }
 
 
 void SymbolicInterpreter::Call(id_t id, function_id_t fid) {
   IFDEBUG(fprintf(stderr, "call %u\n", fid));
-  ex_.mutable_path()->Push(kCallId);
+  PushPath(CurrentThread(), kCallId, NULL);
   IFDEBUG(DumpMemory());
 }
 
@@ -296,13 +341,14 @@ void SymbolicInterpreter::Call(id_t id, function_id_t fid) {
 void SymbolicInterpreter::Return(id_t id) {
   IFDEBUG(fprintf(stderr, "return\n"));
 
-  ex_.mutable_path()->Push(kReturnId);
+  ThreadState* ts = CurrentThread();
+  PushPath(ts, kReturnId, NULL);
 
   // There is either exactly one value on the stack -- the current function's
   // return value -- or the stack is empty.
-  assert(stack_.size() <= 1);
+  assert(ts->stack.size() <= 1);
 
-  return_value_ = (stack_.size() == 1);
+  ts->return_value = (ts->stack.size() == 1);
 
   IFDEBUG(DumpMemory());
 }
@@ -311,17 +357,18 @@ void SymbolicInterpreter::Return(id_t id) {
 void SymbolicInterpreter::HandleReturn(id_t id, value_t value) {
   IFDEBUG(fprintf(stderr, "handle_return %lld\n", value));
 
-  if (return_value_) {
+  ThreadState* ts = CurrentThread();
+  if (ts->return_value) {
     // We just returned from an instrumented function, so the stack
     // contains a single element -- the (possibly symbolic) return value.
-    assert(stack_.size() == 1);
-    return_value_ = false;
+    assert(ts->stack.size() == 1);
+    ts->return_value = false;
   } else {
     // We just returned from an uninstrumented function, so the stack
     // still contains the arguments to that function.  Thus, we clear
     // the stack and push the concrete value that was returned.
     ClearStack(-1);
-    PushConcrete(value);
+    PushConcrete(ts, value);
   }
 
   IFDEBUG(DumpMemory());
@@ -330,15 +377,16 @@ void SymbolicInterpreter::HandleReturn(id_t id, value_t value) {
 
 void SymbolicInterpreter::Branch(id_t id, branch_id_t bid, bool pred_value) {
   IFDEBUG(fprintf(stderr, "branch %d %d\n", bid, pred_value));
-  assert(stack_.size() == 1);
-  stack_.pop_back();
+  ThreadState* ts = CurrentThread();
+  assert(ts->stack.size() == 1);
+  ts->stack.pop_back();
 
-  if (pred_ && !pred_value) {
-    pred_->Negate();
+  if (ts->pred && !pred_value) {
+    ts->pred->Negate();
   }
 
-  ex_.mutable_path()->Push(bid, pred_);
-  pred_ = NULL;
+  PushPath(ts, bid, ts->pred);
+  ts->pred = NULL;
   IFDEBUG(DumpMemory());
 }
 
@@ -346,18 +394,23 @@ void SymbolicInterpreter::Branch(id_t id, branch_id_t bid, bool pred_value) {
 value_t SymbolicInterpreter::NewInput(type_t type, addr_t addr) {
   IFDEBUG(fprintf(stderr, "symbolic_input %d %lu\n", type, addr));
 
-  mem_[addr] = new SymbolicExpr(1, num_inputs_);
+  MutexLock l(&lock_);
+
+  { MemShard& shard = ShardFor(addr);
+    MutexLock ml(&shard.lock);
+    shard.mem[addr] = new SymbolicExpr(1, num_inputs_);
+  }
   ex_.mutable_vars()->insert(make_pair(num_inputs_ ,type));
 
   value_t ret = 0;
-  if (num_inputs_ < ex_.inputs().size()) {
-    ret = ex_.inputs()[num_inputs_];
+  if (num_inputs_ < input_size_) {
+    ret = input_[num_inputs_];
   } else {
     // Generate a new random input.
     // TODO: User a better pseudorandom number generator.
     ret = CastTo(rand(), type);
-    ex_.mutable_inputs()->push_back(ret);
   }
+  ex_.mutable_inputs()->push_back(ret);
 
   num_inputs_ ++;
 
@@ -366,22 +419,101 @@ value_t SymbolicInterpreter::NewInput(type_t type, addr_t addr) {
 }
 
 
-void SymbolicInterpreter::PushConcrete(value_t value) {
-  PushSymbolic(NULL, value);
+void SymbolicInterpreter::NewInputs(type_t type, addr_t addr,
+                                    size_t n, value_t* values) {
+  IFDEBUG(fprintf(stderr, "symbolic_inputs %d %lu %zu\n", type, addr, n));
+  MutexLock l(&lock_);
+
+  // Variable ID's are increasing, so each one is inserted at the end.
+  map<var_t,type_t>* vars = ex_.mutable_vars();
+  for (size_t i = 0; i < n; i++) {
+    vars->insert(vars->end(), make_pair(num_inputs_ + i, type));
+  }
+
+  // Copy the values we were given (straight from the input file, when
+  // it is mapped), and generate random values for the rest.
+  size_t given = 0;
+  if (num_inputs_ < input_size_) {
+    given = min(n, input_size_ - num_inputs_);
+    copy(input_ + num_inputs_, input_ + num_inputs_ + given, values);
+  }
+  for (size_t i = given; i < n; i++) {
+    values[i] = CastTo(rand(), type);
+  }
+  ex_.mutable_inputs()->insert(ex_.mutable_inputs()->end(), values, values + n);
+
+  // Addresses are increasing, too, so each element is inserted just
+  // after the previous one in its shard, holding the shard's lock across
+  // each run of elements in the same shard.
+  const size_t stride = kByteSize[type];
+  MemShard* shard = NULL;
+  map<addr_t,SymbolicExpr*>::iterator hint;
+  for (size_t i = 0; i < n; i++) {
+    addr_t a = addr + i * stride;
+    if (&ShardFor(a) != shard) {
+      if (shard)
+        pthread_mutex_unlock(&shard->lock);
+      shard = &ShardFor(a);
+      pthread_mutex_lock(&shard->lock);
+      hint = shard->mem.lower_bound(a);
+    }
+    hint = shard->mem.insert(hint, make_pair(a, static_cast<SymbolicExpr*>(NULL)));
+    hint->second = new SymbolicExpr(1, num_inputs_ + i);
+  }
+  if (shard)
+    pthread_mutex_unlock(&shard->lock);
+
+  num_inputs_ += n;
+
+  IFDEBUG(DumpMemory());
+}
+
+
+SymbolicInterpreter::ThreadState* SymbolicInterpreter::CurrentThread() {
+  if (!current_thread_) {
+    MutexLock l(&lock_);
+    current_thread_ = new ThreadState(threads_.size());
+    threads_.push_back(current_thread_);
+  }
+  return current_thread_;
+}
+
+
+SymbolicInterpreter::MemShard& SymbolicInterpreter::ShardFor(addr_t addr) {
+  // Neighboring addresses share a shard, so that the bytes of one
+  // object are usually guarded by the same lock.
+  return mem_[(addr >> kMemShardShift) % kNumMemShards];
+}
+
+
+void SymbolicInterpreter::PushPath(ThreadState* ts,
+                                   branch_id_t bid, SymbolicPred* pred) {
+  MutexLock l(&lock_);
+  if (ts->id != last_thread_) {
+    ex_.mutable_path()->SwitchThread(ts->id);
+    last_thread_ = ts->id;
+  }
+  ex_.mutable_path()->Push(bid, pred);
+}
+
+
+void SymbolicInterpreter::PushConcrete(ThreadState* ts, value_t value) {
+  PushSymbolic(ts, NULL, value);
 }
 
 
-void SymbolicInterpreter::PushSymbolic(SymbolicExpr* expr, value_t value) {
-  stack_.push_back(StackElem());
-  StackElem& se = stack_.back();
+void SymbolicInterpreter::PushSymbolic(ThreadState* ts,
+                                       SymbolicExpr* expr, value_t value) {
+  ts->stack.push_back(StackElem());
+  StackElem& se = ts->stack.back();
   se.expr = expr;
   se.concrete = value;
 }
 
 
-void SymbolicInterpreter::ClearPredicateRegister() {
-  delete pred_;
-  pred_ = NULL;
+void SymbolicInterpreter::ClearPredicateRegister(ThreadState* ts) {
+  delete ts->pred;
+  ts->pred = NULL;
 }
 
 
@@ -11,6 +11,7 @@
 #ifndef BASE_SYMBOLIC_INTERPRETER_H__
 #define BASE_SYMBOLIC_INTERPRETER_H__
 
+#include <pthread.h>
 #include <stdio.h>
 
 #include <ext/hash_map>
@@ -29,10 +30,18 @@ using __gnu_cxx::hash_map;
 
 namespace crest {
 
+// The interpreter may be driven concurrently by several threads of the
+// program under test.  Each thread has its own operand stack and
+// predicate register, symbolic memory is shared (and locked per shard),
+// and branches from all threads are recorded into a single path tagged
+// with the thread that executed them.
 class SymbolicInterpreter {
  public:
   SymbolicInterpreter();
-  explicit SymbolicInterpreter(const vector<value_t>& input);
+
+  // The given inputs are read in place, as they are needed, so they
+  // must outlive the interpreter.
+  SymbolicInterpreter(const value_t* input, size_t input_size);
 
   void ClearStack(id_t id);
   void Load(id_t id, addr_t addr, value_t value);
@@ -50,6 +59,11 @@ class SymbolicInterpreter {
 
   value_t NewInput(type_t type, addr_t addr);
 
+  // Creates 'n' symbolic inputs of the given type, for the consecutive
+  // elements of the array at 'addr', with consecutive variable ID's.
+  // Their concrete values are written to 'values'.
+  void NewInputs(type_t type, addr_t addr, size_t n, value_t* values);
+
   // Accessor for symbolic execution so far.
   const SymbolicExecution& execution() const { return ex_; }
 
@@ -63,17 +77,43 @@ class SymbolicInterpreter {
     value_t concrete;
   };
 
-  // Stack.
-  vector<StackElem> stack_;
+  // Per-thread state.
+  struct ThreadState {
+    explicit ThreadState(unsigned int tid)
+      : pred(NULL), return_value(false), id(tid) { stack.reserve(16); }
+
+    // Stack.
+    vector<StackElem> stack;
+
+    // Predicate register (for when top of stack is a symbolic predicate).
+    SymbolicPred* pred;
+
+    // Is the top of the stack a function return value?
+    bool return_value;
+
+    // Index of the thread, in order of first instrumentation call.
+    unsigned int id;
+  };
+
+  // State of the calling thread (there is only one interpreter per
+  // process).
+  static __thread ThreadState* current_thread_;
 
-  // Predicate register (for when top of stack is a symbolic predicate).
-  SymbolicPred* pred_;
+  // Memory map, sharded by address.
+  static const size_t kNumMemShards = 64;
+  static const int kMemShardShift = 6;
+  struct MemShard {
+    pthread_mutex_t lock;
+    map<addr_t,SymbolicExpr*> mem;
+  };
+  MemShard mem_[kNumMemShards];
 
-  // Is the top of the stack a function return value?
-  bool return_value_;
+  // Guards the execution, the input count, and the thread list.
+  pthread_mutex_t lock_;
 
-  // Memory map.
-  map<addr_t,SymbolicExpr*> mem_;
+  // The given input values.
+  const value_t* input_;
+  size_t input_size_;
 
   // The symbolic execution (program path and inputs).
   SymbolicExecution ex_;
@@ -81,10 +121,18 @@ class SymbolicInterpreter {
   // Number of symbolic inputs so far.
   unsigned int num_inputs_;
 
+  // All threads seen so far, and the last one to record a branch.
+  vector<ThreadState*> threads_;
+  unsigned int last_thread_;
+
   // Helper functions.
-  inline void PushConcrete(value_t value);
-  inline void PushSymbolic(SymbolicExpr* expr, value_t value);
-  inline void ClearPredicateRegister();
+  void Init();
+  inline ThreadState* CurrentThread();
+  inline MemShard& ShardFor(addr_t addr);
+  inline void PushPath(ThreadState* ts, branch_id_t bid, SymbolicPred* pred);
+  inline void PushConcrete(ThreadState* ts, value_t value);
+  inline void PushSymbolic(ThreadState* ts, SymbolicExpr* expr, value_t value);
+  inline void ClearPredicateRegister(ThreadState* ts);
 };
 
 }  // namespace crest
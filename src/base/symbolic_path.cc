@@ -9,25 +9,20 @@
 // for details.
 
 #include "base/symbolic_path.h"
+#include <limits>
 #include <stdio.h>
 
-#define DEBUG(x)
+using std::numeric_limits;
 
-#define MAX_LINE_BUF 4096
+#define DEBUG(x)
 
 
 namespace crest {
 
-SymbolicPath::SymbolicPath() { }
+SymbolicPath::SymbolicPath() : record_(false), path_hash_(kEmptyPathHash) { }
 
-SymbolicPath::SymbolicPath(bool pre_allocate) {
-  if (pre_allocate) {
-    // To cut down on re-allocation.
-    branches_.reserve(4000000);
-    constraints_idx_.reserve(50000);
-    constraints_.reserve(50000);
-  }
-}
+SymbolicPath::SymbolicPath(bool record)
+  : record_(record), path_hash_(kEmptyPathHash) { }
 
 SymbolicPath::~SymbolicPath() {
   for (size_t i = 0; i < constraints_.size(); i++)
@@ -35,21 +30,37 @@ SymbolicPath::~SymbolicPath() {
 }
 
 void SymbolicPath::Swap(SymbolicPath& sp) {
+  swap(record_, sp.record_);
+  trace_.Swap(sp.trace_);
   branches_.swap(sp.branches_);
   constraints_idx_.swap(sp.constraints_idx_);
   constraints_.swap(sp.constraints_);
+  thread_switches_idx_.swap(sp.thread_switches_idx_);
+  thread_switches_.swap(sp.thread_switches_);
+  prefix_hashes_.swap(sp.prefix_hashes_);
+  swap(path_hash_, sp.path_hash_);
 }
 
 void SymbolicPath::Push(branch_id_t bid) {
-  branches_.push_back(bid);
+  path_hash_ = ExtendPathHash(path_hash_, bid);
+  if (record_) {
+    trace_.push_back(bid);
+  } else {
+    branches_.push_back(bid);
+  }
 }
 
 void SymbolicPath::Push(branch_id_t bid, SymbolicPred* constraint) {
   if (constraint) {
     constraints_.push_back(constraint);
-    constraints_idx_.push_back(branches_.size());
+    constraints_idx_.push_back(record_ ? trace_.size() : branches_.size());
   }
-  branches_.push_back(bid);
+  Push(bid);
+}
+
+void SymbolicPath::SwitchThread(unsigned int tid) {
+  thread_switches_idx_.push_back(record_ ? trace_.size() : branches_.size());
+  thread_switches_.push_back(tid);
 }
 
 void SymbolicPath::Serialize(string* s) const {
@@ -60,14 +71,24 @@ void SymbolicPath::Serialize(string* s) const {
   char buf[32];
 
   // Write the path.
-  size_t len = branches_.size();
+  size_t len = record_ ? trace_.size() : branches_.size();
 
   sprintf(buf, "%d\n", len);
   s->append(string(buf));
 
-  for (size_t i = 0; i < len; i++) {
-    sprintf(buf, "%d ", branches_[i]);
-    s->append(string(buf));
+  if (record_) {
+    for (size_t i = 0; i < trace_.num_chunks(); i++) {
+      const branch_id_t* chunk = trace_.chunk(i);
+      for (size_t j = 0; j < trace_.chunk_size(i); j++) {
+        sprintf(buf, "%d ", chunk[j]);
+        s->append(string(buf));
+      }
+    }
+  } else {
+    for (size_t i = 0; i < len; i++) {
+      sprintf(buf, "%d ", branches_[i]);
+      s->append(string(buf));
+    }
   }
   s->append(string("\n"));
 
@@ -85,33 +106,30 @@ void SymbolicPath::Serialize(string* s) const {
   for (ConIt i = constraints_.begin(); i != constraints_.end(); ++i) {
     (*i)->Serialize(s);
   }
+
+  // Write the thread switches.
+  len = thread_switches_.size();
+  sprintf(buf, "%zu\n", len);
+  s->append(string(buf));
+  for (size_t i = 0; i < len; i++) {
+    sprintf(buf, "%zu %u ", thread_switches_idx_[i], thread_switches_[i]);
+    s->append(string(buf));
+  }
+  s->append(string("\n"));
 }
 
 bool SymbolicPath::Parse(istream& s) {
   typedef vector<SymbolicPred*>::iterator ConIt;
-  typedef vector<size_t*>::iterator ConIdxIt;
-  typedef vector<branch_id_t*>::iterator BranIt;
-  int len;
-  char buf[MAX_LINE_BUF];
-
-  // read #branches
-  s.getline(buf, MAX_LINE_BUF);
-  sscanf(buf, "%d", &len);
+  size_t len;
 
-  DEBUG(fprintf(stderr, "#branches = %d\n", len));
-  DEBUG(fprintf(stderr, "branch ids:\n"));  
+  // Read the path.  (The lines can be arbitrarily long, so they are
+  // read token by token.)
+  s >> len;
+  DEBUG(fprintf(stderr, "#branches = %zu\n", len));
   branches_.resize(len);
-  s.getline(buf, MAX_LINE_BUF);
-  char *ptr = buf;
-  for(int i = 0; i < len; i++) {
-    int bid;
-    sscanf(ptr, "%d", &bid);
-    DEBUG(fprintf(stderr, "%d ", bid));
-    while (*ptr != ' ') ptr++;
-    ptr++;
-    branches_.push_back(bid);
+  for (size_t i = 0; i < len; i++) {
+    s >> branches_[i];
   }
-  DEBUG(fprintf(stderr, "\n"));
   if (s.fail())
     return false;
 
@@ -120,35 +138,51 @@ bool SymbolicPath::Parse(istream& s) {
     delete constraints_[i];
 
   // Read the path constraints.
-  s.getline(buf, MAX_LINE_BUF);
-  sscanf(buf, "%d", &len);
+  s >> len;
+  DEBUG(fprintf(stderr, "#constaints = %zu\n", len));
   constraints_idx_.resize(len);
   constraints_.resize(len);
-
-  DEBUG(fprintf(stderr, "#constaints = %d\n", len));
-  DEBUG(fprintf(stderr, "constraints idxes:\n"));  
-
-  s.getline(buf, MAX_LINE_BUF);
-  ptr = buf;
-  for(int i = 0; i < len; i++) {
-    int cid;
-    sscanf(ptr, "%d", &cid);
-    DEBUG(fprintf(stderr, "%d ", cid));
-    while (*ptr != ' ') ptr++;
-    ptr++;
-    constraints_idx_.push_back(cid);
+  for (size_t i = 0; i < len; i++) {
+    s >> constraints_idx_[i];
   }
-  DEBUG(fprintf(stderr, "\n"));
+  s.ignore(numeric_limits<std::streamsize>::max(), '\n');
 
   if (s.fail())
     return false;
 
+  // Hash the prefix preceding each constraint.
+  prefix_hashes_.resize(len);
+  { path_hash_t h = kEmptyPathHash;
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++) {
+      if (constraints_idx_[i] >= branches_.size())
+        return false;
+      for (; j < constraints_idx_[i]; j++)
+        h = ExtendPathHash(h, branches_[j]);
+      prefix_hashes_[i] = h;
+    }
+    for (; j < branches_.size(); j++)
+      h = ExtendPathHash(h, branches_[j]);
+    path_hash_ = h;
+  }
+
   DEBUG(fprintf(stderr, "Parse predicates\n"));
   for (ConIt i = constraints_.begin(); i != constraints_.end(); ++i) {
     *i = new SymbolicPred();
     if (!(*i)->Parse(s))
       return false;
   }
+
+  // Read the thread switches.
+  size_t num_switches;
+  s >> num_switches;
+  thread_switches_idx_.resize(num_switches);
+  thread_switches_.resize(num_switches);
+  for (size_t i = 0; i < num_switches; i++) {
+    s >> thread_switches_idx_[i] >> thread_switches_[i];
+  }
+  s.ignore(numeric_limits<std::streamsize>::max(), '\n');
+
   return !s.fail();
 }
 
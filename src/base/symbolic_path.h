@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "base/basic_types.h"
+#include "base/segmented_buffer.h"
 #include "base/symbolic_predicate.h"
 
 using std::istream;
@@ -26,27 +27,64 @@ using std::vector;
 
 namespace crest {
 
+// Path prefixes are identified by a rolling (FNV-1a) hash of their
+// branches: the hash of a prefix extended by branch b is
+// ExtendPathHash(hash, b).
+typedef unsigned long long path_hash_t;
+
+const path_hash_t kEmptyPathHash = 14695981039346656037ULL;
+
+inline path_hash_t ExtendPathHash(path_hash_t h, branch_id_t b) {
+  return (h ^ static_cast<path_hash_t>(b)) * 1099511628211ULL;
+}
+
 class SymbolicPath {
  public:
   SymbolicPath();
-  SymbolicPath(bool pre_allocate);
+
+  // A path constructed with 'record' set is being recorded by an
+  // instrumented program.  Its branches are appended to segmented
+  // storage that grows on demand, so it supports only Push and
+  // Serialize -- branches() stays empty.
+  explicit SymbolicPath(bool record);
   ~SymbolicPath();
 
   void Swap(SymbolicPath& sp);
 
   void Push(branch_id_t bid);
   void Push(branch_id_t bid, SymbolicPred* constraint);
+
+  // Records that the branches pushed from now on are executed by thread
+  // 'tid'.  (Branches before the first switch belong to thread 0.)
+  void SwitchThread(unsigned int tid);
   void Serialize(string* s) const;
   bool Parse(istream& s);
 
   const vector<branch_id_t>& branches() const { return branches_; }
   const vector<SymbolicPred*>& constraints() const { return constraints_; }
   const vector<size_t>& constraints_idx() const { return constraints_idx_; }
+  const vector<size_t>& thread_switches_idx() const { return thread_switches_idx_; }
+  const vector<unsigned int>& thread_switches() const { return thread_switches_; }
+
+  // For each constraint, the hash of the prefix of the path before the
+  // constraint's branch.  (Only computed when a path is parsed.)
+  const vector<path_hash_t>& prefix_hashes() const { return prefix_hashes_; }
+
+  // The hash of the whole path, kept up to date as branches are pushed
+  // (so that the runtime can write it ahead of the path).
+  path_hash_t path_hash() const { return path_hash_; }
 
  private:
+  bool record_;
+  SegmentedBuffer<branch_id_t> trace_;
+
   vector<branch_id_t> branches_;
   vector<size_t> constraints_idx_;
   vector<SymbolicPred*> constraints_;
+  vector<size_t> thread_switches_idx_;
+  vector<unsigned int> thread_switches_;
+  vector<path_hash_t> prefix_hashes_;
+  path_hash_t path_hash_;
 };
 
 }  // namespace crest
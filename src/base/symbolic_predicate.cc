@@ -54,7 +54,7 @@ bool SymbolicPred::Parse(istream& s) {
   s.getline(buf, 8);
   sscanf(buf, "%d", &op_);
   DEBUG(fprintf(stderr, "%s: op_=%d\n", __FUNCTION__, op_));
-  expr_->Parse(s);
+  return expr_->Parse(s);
 }
 
 bool SymbolicPred::Equal(const SymbolicPred& p) const {
@@ -14,6 +14,7 @@
 #include <sys/time.h>
 #include <vector>
 
+#include "base/input_file.h"
 #include "base/symbolic_interpreter.h"
 #include "libcrest/crest.h"
 
@@ -25,8 +26,9 @@ static SymbolicInterpreter* SI;
 
 // Have we read an input yet?  Until we have, generate only the
 // minimal instrumentation necessary to track which branches were
-// reached by the execution path.
-static int pre_symbolic;
+// reached by the execution path.  (Also tested by the inline guards in
+// libcrest/crest.h, so most calls are skipped before reaching here.)
+int __CrestPreSymbolic = 1;
 
 // Tables for converting from operators defined in libcrest/crest.h to
 // those defined in base/basic_types.h.
@@ -55,18 +57,13 @@ void __CrestInit() {
   gettimeofday(&tv, NULL);
   srand((tv.tv_sec * 1000000) + tv.tv_usec);
 
-  // Read the input.
-  vector<value_t> input;
-  std::ifstream in("input");
-  value_t val;
-  while (in >> val) {
-    input.push_back(val);
-  }
-  in.close();
+  // Map the input (which is read in place, and never unmapped).
+  InputFile* input = new InputFile();
+  input->Open("input");
 
-  SI = new SymbolicInterpreter(input);
+  SI = new SymbolicInterpreter(input->values(), input->size());
 
-  pre_symbolic = 1;
+  __CrestPreSymbolic = 1;
 
   assert(!atexit(__CrestAtExit));
 }
@@ -75,9 +72,9 @@ void __CrestInit() {
 void __CrestAtExit() {
   const SymbolicExecution& ex = SI->execution();
 
-  // Write the execution out to file 'szd_execution'.
+  // Write the execution out to file 'szd_execution'.  (The buffer grows
+  // with the size of the execution, rather than being reserved up front.)
   string buff;
-  buff.reserve(1<<26);
   ex.Serialize(&buff);
   std::ofstream out("szd_execution", std::ios::out | std::ios::binary);
   out.write(buff.data(), buff.size());
@@ -91,19 +88,19 @@ void __CrestAtExit() {
 //
 
 void __CrestLoad(__CREST_ID id, __CREST_ADDR addr, __CREST_VALUE val) {
-  if (!pre_symbolic)
+  if (!__CrestPreSymbolic)
     SI->Load(id, addr, val);
 }
 
 
 void __CrestStore(__CREST_ID id, __CREST_ADDR addr) {
-  if (!pre_symbolic)
+  if (!__CrestPreSymbolic)
     SI->Store(id, addr);
 }
 
 
 void __CrestClearStack(__CREST_ID id) {
-  if (!pre_symbolic)
+  if (!__CrestPreSymbolic)
     SI->ClearStack(id);
 }
 
@@ -111,7 +108,7 @@ void __CrestClearStack(__CREST_ID id) {
 void __CrestApply1(__CREST_ID id, __CREST_OP op, __CREST_VALUE val) {
   assert((op >= __CREST_NEGATE) && (op <= __CREST_L_NOT));
 
-  if (!pre_symbolic)
+  if (!__CrestPreSymbolic)
     SI->ApplyUnaryOp(id, static_cast<unary_op_t>(kOpTable[op]), val);
 }
 
@@ -119,7 +116,7 @@ void __CrestApply1(__CREST_ID id, __CREST_OP op, __CREST_VALUE val) {
 void __CrestApply2(__CREST_ID id, __CREST_OP op, __CREST_VALUE val) {
   assert((op >= __CREST_ADD) && (op <= __CREST_CONCRETE));
 
-  if (pre_symbolic)
+  if (__CrestPreSymbolic)
     return;
 
   if ((op >= __CREST_ADD) && (op <= __CREST_L_OR)) {
@@ -130,8 +127,37 @@ void __CrestApply2(__CREST_ID id, __CREST_OP op, __CREST_VALUE val) {
 }
 
 
+void __CrestEval(__CREST_ID id, const char* code,
+                 const __CREST_ADDR* addrs, const __CREST_VALUE* vals) {
+  if (__CrestPreSymbolic)
+    return;
+
+  // The Loads and Applys, in one pass over the descriptor.
+  for (; *code; code++) {
+    if (*code == __CREST_EXPR_LOAD) {
+      SI->Load(id, *addrs++, *vals++);
+      continue;
+    }
+    if (*code == __CREST_EXPR_CONST) {
+      SI->Load(id, 0, *vals++);
+      continue;
+    }
+
+    const int op = *code - __CREST_EXPR_APPLY;
+    assert((op >= __CREST_ADD) && (op <= __CREST_L_NOT));
+    if (op >= __CREST_NEGATE) {
+      SI->ApplyUnaryOp(id, static_cast<unary_op_t>(kOpTable[op]), *vals++);
+    } else if (op <= __CREST_L_OR) {
+      SI->ApplyBinaryOp(id, static_cast<binary_op_t>(kOpTable[op]), *vals++);
+    } else {
+      SI->ApplyCompareOp(id, static_cast<compare_op_t>(kOpTable[op]), *vals++);
+    }
+  }
+}
+
+
 void __CrestBranch(__CREST_ID id, __CREST_BRANCH_ID bid, __CREST_BOOL b) {
-  if (pre_symbolic) {
+  if (__CrestPreSymbolic) {
     // Precede the branch with a fake (concrete) load.
     SI->Load(id, 0, b);
   }
@@ -151,7 +177,7 @@ void __CrestReturn(__CREST_ID id) {
 
 
 void __CrestHandleReturn(__CREST_ID id, __CREST_VALUE val) {
-  if (!pre_symbolic)
+  if (!__CrestPreSymbolic)
     SI->HandleReturn(id, val);
 }
 
@@ -161,31 +187,42 @@ void __CrestHandleReturn(__CREST_ID id, __CREST_VALUE val) {
 //
 
 void __CrestUChar(unsigned char* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (unsigned char)SI->NewInput(types::U_CHAR, (addr_t)x);
 }
 
 void __CrestUShort(unsigned short* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (unsigned short)SI->NewInput(types::U_SHORT, (addr_t)x);
 }
 
 void __CrestUInt(unsigned int* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (unsigned int)SI->NewInput(types::U_INT, (addr_t)x);
 }
 
 void __CrestChar(char* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (char)SI->NewInput(types::CHAR, (addr_t)x);
 }
 
 void __CrestShort(short* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (short)SI->NewInput(types::SHORT, (addr_t)x);
 }
 
 void __CrestInt(int* x) {
-  pre_symbolic = 0;
+  __CrestPreSymbolic = 0;
   *x = (int)SI->NewInput(types::INT, (addr_t)x);
 }
+
+void __CrestBytes(unsigned char* x, __CREST_SIZE n) {
+  __CrestPreSymbolic = 0;
+  if (n == 0)
+    return;
+  vector<value_t> vals(n);
+  SI->NewInputs(types::U_CHAR, (addr_t)x, n, &vals.front());
+  for (size_t i = 0; i < n; i++) {
+    x[i] = (unsigned char)vals[i];
+  }
+}
@@ -0,0 +1,316 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <algorithm>
+#include <assert.h>
+#include <fstream>
+#include <istream>
+#include <utility>
+
+#include "process_cfg/cfg_fragments.h"
+
+using std::ifstream;
+using std::ios;
+using std::istream;
+using std::lower_bound;
+using std::make_pair;
+using std::ofstream;
+using std::pair;
+using std::sort;
+using std::unique;
+
+namespace crest {
+
+namespace {
+
+const char kCacheMagic[4] = { 'C', 'F', 'C', '1' };
+
+template <typename T>
+void WriteRaw(string* s, const T& x) {
+  s->append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+template <typename T>
+bool ReadRaw(istream& in, T* x) {
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(x), sizeof(*x)));
+}
+
+void WriteString(string* s, const string& x) {
+  WriteRaw(s, static_cast<unsigned>(x.size()));
+  s->append(x);
+}
+
+bool ReadString(istream& in, string* x) {
+  unsigned len;
+  if (!ReadRaw(in, &len) || (len > (1 << 16)))
+    return false;
+  x->resize(len);
+  return (len == 0) || static_cast<bool>(in.read(&(*x)[0], len));
+}
+
+// FNV-1a.
+void HashBytes(unsigned long long* h, const void* p, size_t len) {
+  const unsigned char* c = static_cast<const unsigned char*>(p);
+  for (size_t i = 0; i < len; i++) {
+    *h = (*h ^ c[i]) * 1099511628211ULL;
+  }
+}
+
+}  // namespace
+
+
+CfgFragments::CfgFragments(const graph_t& g, const vector<bool>& is_branch,
+                           const map<string,int>& func_entries)
+  : g_(g), is_branch_(is_branch), node_frag_(g.size()),
+    num_branches_thinned_(0) {
+
+  vector< pair<int,string> > entries;
+  for (map<string,int>::const_iterator i = func_entries.begin();
+       i != func_entries.end(); ++i) {
+    if ((i->second >= 0) && (static_cast<size_t>(i->second) < g.size()))
+      entries.push_back(make_pair(i->second, i->first));
+  }
+  sort(entries.begin(), entries.end());
+
+  // Any nodes before the first function entry form an unnamed fragment.
+  if (entries.empty() || (entries.front().first > 0))
+    entries.insert(entries.begin(), make_pair(0, string()));
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if ((i > 0) && (entries[i].first == entries[i-1].first))
+      continue;
+    Fragment f;
+    f.name = entries[i].second;
+    f.start = entries[i].first;
+    f.up_to_date = false;
+    frags_.push_back(f);
+  }
+
+  for (size_t k = 0; k < frags_.size(); k++) {
+    Fragment& f = frags_[k];
+    f.end = (k + 1 < frags_.size()) ? frags_[k+1].start : g.size();
+    for (int n = f.start; n < f.end; n++) {
+      node_frag_[n] = k;
+      if (is_branch_[n])
+        f.branches.push_back(n);
+    }
+    frag_index_[f.name] = k;
+  }
+
+  // Hashes may refer to the names of other fragments.
+  for (size_t k = 0; k < frags_.size(); k++) {
+    frags_[k].hash = Hash(frags_[k]);
+  }
+}
+
+
+unsigned long long CfgFragments::Hash(const Fragment& f) const {
+  // Each edge is hashed by the name of the fragment it goes to and its
+  // offset in that fragment, rather than by node id.
+  unsigned long long h = 14695981039346656037ULL;
+  for (int n = f.start; n < f.end; n++) {
+    const unsigned char b = is_branch_[n];
+    const unsigned num_edges = g_[n].size();
+    HashBytes(&h, &b, sizeof(b));
+    HashBytes(&h, &num_edges, sizeof(num_edges));
+    for (adj_list_t::const_iterator e = g_[n].begin(); e != g_[n].end(); ++e) {
+      const Fragment& to = frags_[node_frag_[e->first]];
+      const int offset = e->first - to.start;
+      HashBytes(&h, to.name.c_str(), to.name.size() + 1);
+      HashBytes(&h, &offset, sizeof(offset));
+    }
+  }
+  return h;
+}
+
+
+bool CfgFragments::LoadCache(const string& file) {
+  ifstream in(file.c_str(), ios::in | ios::binary);
+  char magic[sizeof(kCacheMagic)];
+  if (!in.read(magic, sizeof(magic))
+      || !std::equal(magic, magic + sizeof(magic), kCacheMagic))
+    return false;
+
+  unsigned long long num_frags;
+  if (!ReadRaw(in, &num_frags))
+    return false;
+
+  for (unsigned long long i = 0; i < num_frags; i++) {
+    string name;
+    unsigned long long hash;
+    unsigned num_deps;
+    if (!ReadString(in, &name) || !ReadRaw(in, &hash) || !ReadRaw(in, &num_deps))
+      return false;
+
+    // The fragment is up to date only if it, and every fragment it
+    // reached, is unchanged.
+    map<string,int>::const_iterator it = frag_index_.find(name);
+    bool valid = (it != frag_index_.end()) && (frags_[it->second].hash == hash);
+
+    vector<int> slots(1, (it != frag_index_.end()) ? it->second : -1);
+    for (unsigned j = 0; j < num_deps; j++) {
+      string dep_name;
+      unsigned long long dep_hash;
+      if (!ReadString(in, &dep_name) || !ReadRaw(in, &dep_hash))
+        return false;
+      map<string,int>::const_iterator dep = frag_index_.find(dep_name);
+      if ((dep == frag_index_.end()) || (frags_[dep->second].hash != dep_hash)) {
+        valid = false;
+        slots.push_back(-1);
+      } else {
+        slots.push_back(dep->second);
+      }
+    }
+
+    unsigned num_branches;
+    if (!ReadRaw(in, &num_branches))
+      return false;
+    if (valid && (num_branches != frags_[slots[0]].branches.size()))
+      valid = false;
+
+    vector< vector<int> > nbhrs(num_branches);
+    for (unsigned j = 0; j < num_branches; j++) {
+      unsigned len;
+      if (!ReadRaw(in, &len))
+        return false;
+      for (unsigned k = 0; k < len; k++) {
+        unsigned slot;
+        int offset;
+        if (!ReadRaw(in, &slot) || !ReadRaw(in, &offset))
+          return false;
+        if (!valid)
+          continue;
+        if ((slot >= slots.size()) || (offset < 0)
+            || (offset >= frags_[slots[slot]].end - frags_[slots[slot]].start)) {
+          valid = false;
+          continue;
+        }
+        nbhrs[j].push_back(frags_[slots[slot]].start + offset);
+      }
+    }
+
+    if (valid) {
+      Fragment& f = frags_[slots[0]];
+      f.nbhrs.swap(nbhrs);
+      f.deps.assign(slots.begin() + 1, slots.end());
+      sort(f.deps.begin(), f.deps.end());
+      f.up_to_date = true;
+    }
+  }
+
+  return true;
+}
+
+
+bool CfgFragments::SaveCache(const string& file) const {
+  string s(kCacheMagic, sizeof(kCacheMagic));
+  WriteRaw(&s, static_cast<unsigned long long>(frags_.size()));
+
+  for (size_t k = 0; k < frags_.size(); k++) {
+    const Fragment& f = frags_[k];
+    assert(f.up_to_date);
+    WriteString(&s, f.name);
+    WriteRaw(&s, f.hash);
+    WriteRaw(&s, static_cast<unsigned>(f.deps.size()));
+    for (size_t j = 0; j < f.deps.size(); j++) {
+      WriteString(&s, frags_[f.deps[j]].name);
+      WriteRaw(&s, frags_[f.deps[j]].hash);
+    }
+
+    // Each neighbor is saved as the fragment it is in -- zero for this
+    // fragment, or one plus its index in deps -- and its offset there.
+    WriteRaw(&s, static_cast<unsigned>(f.nbhrs.size()));
+    for (size_t j = 0; j < f.nbhrs.size(); j++) {
+      WriteRaw(&s, static_cast<unsigned>(f.nbhrs[j].size()));
+      for (size_t m = 0; m < f.nbhrs[j].size(); m++) {
+        const int to = node_frag_[f.nbhrs[j][m]];
+        unsigned slot = 0;
+        if (to != static_cast<int>(k)) {
+          vector<int>::const_iterator d =
+            lower_bound(f.deps.begin(), f.deps.end(), to);
+          assert((d != f.deps.end()) && (*d == to));
+          slot = 1 + (d - f.deps.begin());
+        }
+        WriteRaw(&s, slot);
+        WriteRaw(&s, f.nbhrs[j][m] - frags_[to].start);
+      }
+    }
+  }
+
+  ofstream out(file.c_str(), ios::out | ios::binary | ios::trunc);
+  out.write(s.data(), s.size());
+  return static_cast<bool>(out);
+}
+
+
+size_t CfgFragments::Thin() {
+  vector<int> todo;
+  for (size_t k = 0; k < frags_.size(); k++) {
+    if (!frags_[k].up_to_date)
+      todo.push_back(k);
+  }
+
+  size_t num_branches = 0;
+
+  // Each thread has its own thinner, and fills in whole fragments.
+#pragma omp parallel reduction(+:num_branches)
+  {
+    CfgThinner thinner(g_);
+    vector<int> reached;
+
+#pragma omp for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(todo.size()); i++) {
+      Fragment& f = frags_[todo[i]];
+      f.nbhrs.assign(f.branches.size(), vector<int>());
+      f.deps.clear();
+      for (size_t j = 0; j < f.branches.size(); j++) {
+        thinner.BranchNeighbors(f.branches[j], is_branch_, &f.nbhrs[j], &reached);
+        for (size_t m = 0; m < reached.size(); m++) {
+          if (node_frag_[reached[m]] != todo[i])
+            f.deps.push_back(node_frag_[reached[m]]);
+        }
+      }
+      sort(f.deps.begin(), f.deps.end());
+      f.deps.erase(unique(f.deps.begin(), f.deps.end()), f.deps.end());
+      f.up_to_date = true;
+      num_branches += f.branches.size();
+    }
+  }
+
+  num_branches_thinned_ += num_branches;
+  return todo.size();
+}
+
+
+size_t CfgFragments::Write(ostream& out) const {
+  size_t len = 0;
+  for (size_t k = 0; k < frags_.size(); k++) {
+    len += frags_[k].branches.size();
+  }
+  out.write((char*)&len, sizeof(len));
+
+  size_t num_edges = 0;
+  for (size_t k = 0; k < frags_.size(); k++) {
+    const Fragment& f = frags_[k];
+    assert(f.up_to_date);
+    for (size_t j = 0; j < f.branches.size(); j++) {
+      const int dest = f.branches[j];
+      const size_t num_nbhrs = f.nbhrs[j].size();
+      out.write((char*)&dest, sizeof(dest));
+      out.write((char*)&num_nbhrs, sizeof(num_nbhrs));
+      if (num_nbhrs > 0)
+        out.write((char*)&f.nbhrs[j].front(), num_nbhrs * sizeof(int));
+      num_edges += num_nbhrs;
+    }
+  }
+  return num_edges;
+}
+
+}  // namespace crest
@@ -0,0 +1,85 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef PROCESS_CFG_CFG_FRAGMENTS_H__
+#define PROCESS_CFG_CFG_FRAGMENTS_H__
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "process_cfg/thin_cfg.h"
+
+using std::map;
+using std::ostream;
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// The CFG, split into fragments -- one per function in cfg_func_map,
+// covering the nodes from the function's entry up to the next entry --
+// so the thinned edges of each fragment can be cached between runs of
+// process_cfg.  A fragment is thinned again only if its own content
+// hash, or that of a fragment its searches reached (e.g. a callee), has
+// changed since the cache was written.
+//
+// Cached node ids are saved relative to the start of their fragment, so
+// they survive the renumbering of an unchanged function's statements
+// (e.g. when a file compiled earlier in the build grows).
+class CfgFragments {
+ public:
+  // The graph must have edge lengths set, and cover every branch.
+  CfgFragments(const graph_t& g, const vector<bool>& is_branch,
+               const map<string,int>& func_entries);
+
+  // Reads a cache written by SaveCache, keeping the thinned edges of
+  // every fragment which is still up to date.  Returns false if the
+  // cache is missing or unreadable.
+  bool LoadCache(const string& file);
+
+  bool SaveCache(const string& file) const;
+
+  // Thins, in parallel, every fragment without up-to-date edges.
+  // Returns the number of fragments thinned.
+  size_t Thin();
+
+  // Writes the thinned edges of every branch, in cfg_branches format.
+  // Returns the number of edges written.
+  size_t Write(ostream& out) const;
+
+  size_t num_fragments() const { return frags_.size(); }
+  size_t num_branches_thinned() const { return num_branches_thinned_; }
+
+ private:
+  struct Fragment {
+    string name;
+    int start, end;
+    unsigned long long hash;
+    bool up_to_date;
+    vector<int> branches;
+    vector< vector<int> > nbhrs;  // For each branch.
+    vector<int> deps;  // The other fragments reached, in increasing order.
+  };
+
+  unsigned long long Hash(const Fragment& f) const;
+
+  const graph_t& g_;
+  const vector<bool>& is_branch_;
+  vector<Fragment> frags_;  // In order of start.
+  vector<int> node_frag_;
+  map<string,int> frag_index_;
+  size_t num_branches_thinned_;
+};
+
+}  // namespace crest
+
+#endif  // PROCESS_CFG_CFG_FRAGMENTS_H__
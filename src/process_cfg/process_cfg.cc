@@ -12,7 +12,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <fstream>
-#include <limits>
+#include <map>
 #include <set>
 #include <sstream>
 #include <stdio.h>
@@ -20,14 +20,20 @@
 #include <vector>
 #include <ext/hash_map>
 
+#include "base/program_bundle.h"
+#include "process_cfg/cfg_fragments.h"
+#include "process_cfg/thin_cfg.h"
+
 using namespace std;
 using __gnu_cxx::hash_map;
+using crest::adj_list_t;
+using crest::CfgFragments;
+using crest::graph_t;
+using crest::ProgramBundle;
 
 typedef pair<int,int> edge_t;
-typedef vector< pair<int,size_t> > adj_list_t;
 typedef adj_list_t::iterator nbhr_it;
 typedef adj_list_t::const_iterator const_nbhr_it;
-typedef vector<adj_list_t> graph_t;
 typedef set<int>::const_iterator BranchIt;
 
 namespace __gnu_cxx {
@@ -54,7 +60,7 @@ void readBranches(set<int>* branches) {
   in.close();
 }
 
-void readCfg(graph_t* graph) {
+void readCfg(graph_t* graph, map<string,int>* funcEntries) {
   // First we have to read in the function -> CFG node map.
   hash_map<string,int> funcNodeMap;
   { ifstream in("cfg_func_map");
@@ -65,6 +71,7 @@ void readCfg(graph_t* graph) {
     }
     in.close();
   }
+  funcEntries->insert(funcNodeMap.begin(), funcNodeMap.end());
 
   // No we can read in the CFG edges, substituting the correct CFG nodes
   // for function calls.
@@ -100,49 +107,6 @@ void readCfg(graph_t* graph) {
   in.close();
 }
 
-void dijkstra_bounded_shortest_paths
-(const graph_t& g, int src, vector<size_t>& dist_map, size_t max_dist) {
-
-  // Initialize all distances.
-  for (int i = 0; i < g.size(); i++) {
-    dist_map[i] = numeric_limits<size_t>::max();
-  }
-  dist_map[src] = 0;
-
-  // Initialize the queue.
-  set< pair<size_t, int> > Q;
-  Q.insert(make_pair(0, src));
-
-  // Initialize the sets of seen and finished vertices.
-  set<int> finished;
-
-  while (!Q.empty()) {
-    // Pop the head of the queue.
-    int v = Q.begin()->second;
-    size_t dist = Q.begin()->first;
-    Q.erase(Q.begin());
-
-    // If the current distance is greater than the max, we're done.
-    if (dist > max_dist)
-      break;
-
-    // Otherwise, process the vertex.
-    finished.insert(v);
-    for (const_nbhr_it e = g[v].begin(); e != g[v].end(); ++e) {
-      int u = e->first;
-      if (finished.find(u) == finished.end()) {
-        size_t d = dist_map[v] + e->second;
-        if ((d < dist_map[u]) && (d <= max_dist)) {
-          Q.erase(make_pair(dist_map[u], u));
-          Q.insert(make_pair(d, u));
-          dist_map[u] = d;
-        }
-      }
-    }
-  }
-}
-
-
 int main(void) {
 
   // Read in the set of branches.
@@ -152,55 +116,63 @@ int main(void) {
 
   // Read in the CFG.
   graph_t cfg;
+  map<string,int> funcEntries;
   cfg.reserve(1000000);
-  readCfg(&cfg);
+  readCfg(&cfg, &funcEntries);
   fprintf(stderr, "Read %d nodes.\n", cfg.size());
 
+  // Make sure every branch, and every edge destination, is a node.
+  { size_t num_nodes = cfg.size();
+    if (!branches.empty())
+      num_nodes = max(num_nodes, static_cast<size_t>(*branches.rbegin()) + 1);
+    for (size_t i = 0; i < cfg.size(); i++) {
+      for (const_nbhr_it j = cfg[i].begin(); j != cfg[i].end(); ++j)
+        num_nodes = max(num_nodes, static_cast<size_t>(j->first) + 1);
+    }
+    cfg.resize(num_nodes);
+  }
+
+  vector<bool> is_branch(cfg.size(), false);
+  for (BranchIt i = branches.begin(); i != branches.end(); ++i) {
+    is_branch[*i] = true;
+  }
+
   // Set the length of every edge to 1 if the destination is a branch,
   // and zero otherwise.
   for (size_t i = 0; i < cfg.size(); i++) {
     for (nbhr_it j = cfg[i].begin(); j != cfg[i].end(); ++j) {
-      if (branches.find(j->first) != branches.end()) {
-	j->second = 1;
-      } else {
-	j->second = 0;
-      }
+      j->second = is_branch[j->first] ? 1 : 0;
     }
   }
 
-  std::ofstream out("cfg_branches", std::ios::out | std::ios::binary);
-  size_t len = branches.size();
-  out.write((char*)&len, sizeof(len));
-
   // "Thin" the graph down to unit-length edges between branches by, for each
-  // branch, running Dijstrak's Algorithm until all other branches distance
-  // one away have been discovered.  We print out an adjacency list for the
-  // thinned graph as we go.
-  vector<size_t> dist(cfg.size());
-  vector<int> nbhrs;
-  int numEdges = 0;
-  for (BranchIt i = branches.begin(); i != branches.end(); ++i) {
-    // Compute all shortest-paths of length zero and one from vertex i.
-    dijkstra_bounded_shortest_paths(cfg, *i, dist, 1);
-
-    // Accumulate the branch nodes distance one from i.
-    nbhrs.clear();
-    for (BranchIt j = branches.begin(); j != branches.end(); ++j) {
-      if (dist[*j] == 1) {
-	nbhrs.push_back(*j);
-      }
-    }
-    numEdges += nbhrs.size();
-
-    // Write out the neighbors.
-    len = nbhrs.size();
-    int dest = *i;
-    out.write((char*)&dest, sizeof(dest));
-    out.write((char*)&len, sizeof(len));
-    out.write((char*)&nbhrs.front(), len * sizeof(int));
+  // branch, searching (with a bounded 0-1 BFS) until all other branches
+  // distance one away have been discovered.
+  //
+  // The thinned edges are cached per function in cfg_cache, and a function's
+  // branches are searched from again (in parallel) only if it, or a function
+  // its searches reached, has changed since the last run.
+  CfgFragments frags(cfg, is_branch, funcEntries);
+  const bool cached = frags.LoadCache("cfg_cache");
+  size_t numThinned = frags.Thin();
+  if (cached) {
+    fprintf(stderr, "Reused %zu of %zu functions (%zu branches thinned).\n",
+            frags.num_fragments() - numThinned, frags.num_fragments(),
+            frags.num_branches_thinned());
+  }
+  if (!frags.SaveCache("cfg_cache")) {
+    fprintf(stderr, "Failed to write cfg_cache.\n");
   }
 
+  // The adjacency lists for the thinned graph are written out in order.
+  std::ofstream out("cfg_branches", std::ios::out | std::ios::binary);
+  int numEdges = frags.Write(out);
   out.close();
   fprintf(stderr, "Wrote %d branch edges.\n", numEdges);
+
+  // Bundle the branches and the thinned CFG for run_crest.
+  if (!ProgramBundle::Write("program_bundle", "branches", "cfg_branches")) {
+    fprintf(stderr, "Failed to write program_bundle.\n");
+  }
   return 0;
 }
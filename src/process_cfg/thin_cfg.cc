@@ -0,0 +1,129 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <algorithm>
+#include <limits>
+
+#include "process_cfg/thin_cfg.h"
+
+using std::make_pair;
+using std::min;
+using std::numeric_limits;
+using std::sort;
+
+namespace crest {
+
+namespace {
+
+const unsigned char kUnreached = numeric_limits<unsigned char>::max();
+
+// Branches are thinned in chunks of this many, each written to its own
+// record.
+const size_t kChunkSize = 1024;
+
+void AppendRaw(string* s, const void* p, size_t len) {
+  s->append(static_cast<const char*>(p), len);
+}
+
+}  // namespace
+
+
+CfgThinner::CfgThinner(const graph_t& g)
+  : g_(g), dist_(g.size(), kUnreached), num_nodes_reached_(0) { }
+
+
+void CfgThinner::BranchNeighbors(int src, const vector<bool>& is_branch,
+                                 vector<int>* nbhrs, vector<int>* reached) {
+  const size_t max_dist = 1;
+
+  // 0-1 BFS: nodes across zero-length edges go to the front of the
+  // queue, and across unit-length edges to the back, so nodes are
+  // popped in order of distance.  A node may be queued more than once,
+  // so stale entries are skipped.
+  dist_[src] = 0;
+  touched_.push_back(src);
+  queue_.push_back(make_pair(0, src));
+
+  while (!queue_.empty()) {
+    const size_t d = queue_.front().first;
+    const int v = queue_.front().second;
+    queue_.pop_front();
+    if (d > static_cast<size_t>(dist_[v]))
+      continue;
+
+    for (adj_list_t::const_iterator e = g_[v].begin(); e != g_[v].end(); ++e) {
+      const int u = e->first;
+      const size_t du = d + e->second;
+      if ((du > max_dist) || (du >= dist_[u]))
+        continue;
+
+      if (dist_[u] == kUnreached)
+        touched_.push_back(u);
+      dist_[u] = du;
+      if (e->second == 0) {
+        queue_.push_front(make_pair(du, u));
+      } else {
+        queue_.push_back(make_pair(du, u));
+      }
+    }
+  }
+
+  // Collect the branches at distance one, and reset the nodes reached.
+  nbhrs->clear();
+  for (vector<int>::const_iterator i = touched_.begin(); i != touched_.end(); ++i) {
+    if ((dist_[*i] == max_dist) && is_branch[*i])
+      nbhrs->push_back(*i);
+    dist_[*i] = kUnreached;
+  }
+  num_nodes_reached_ += touched_.size();
+  if (reached)
+    reached->assign(touched_.begin(), touched_.end());
+  touched_.clear();
+
+  sort(nbhrs->begin(), nbhrs->end());
+}
+
+
+size_t ThinBranchCfg(const graph_t& g, const vector<int>& branches,
+                     const vector<bool>& is_branch, vector<string>* records) {
+  const int num_chunks =
+    static_cast<int>((branches.size() + kChunkSize - 1) / kChunkSize);
+  records->assign(num_chunks, string());
+  size_t num_edges = 0;
+
+  // Each thread has its own thinner (so its own distances), and writes
+  // each chunk of branches to the chunk's own record.
+#pragma omp parallel reduction(+:num_edges)
+  {
+    CfgThinner thinner(g);
+    vector<int> nbhrs;
+
+#pragma omp for schedule(dynamic)
+    for (int c = 0; c < num_chunks; c++) {
+      string* record = &(*records)[c];
+      const size_t end = min(branches.size(), (c + 1) * kChunkSize);
+      for (size_t i = c * kChunkSize; i < end; i++) {
+        thinner.BranchNeighbors(branches[i], is_branch, &nbhrs);
+        num_edges += nbhrs.size();
+
+        const int dest = branches[i];
+        const size_t len = nbhrs.size();
+        AppendRaw(record, &dest, sizeof(dest));
+        AppendRaw(record, &len, sizeof(len));
+        if (len > 0)
+          AppendRaw(record, &nbhrs.front(), len * sizeof(int));
+      }
+    }
+  }
+
+  return num_edges;
+}
+
+}  // namespace crest
@@ -0,0 +1,72 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef PROCESS_CFG_THIN_CFG_H__
+#define PROCESS_CFG_THIN_CFG_H__
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::deque;
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// The whole-program CFG: for each node, its successors, each with the
+// length of the edge to it -- one if the successor is a branch, and
+// zero otherwise.
+typedef vector< pair<int,size_t> > adj_list_t;
+typedef vector<adj_list_t> graph_t;
+
+// "Thins" the CFG down to unit-length edges between branches: the
+// neighbors of a branch are the branches at distance exactly one from
+// it.
+//
+// The distances are found with a 0-1 BFS bounded at distance one,
+// which touches only the nodes the search from a branch reaches -- the
+// scratch state is reset node by node, rather than over the whole CFG.
+// A thinner may be reused for any number of branches, but not by
+// several threads at once.
+class CfgThinner {
+ public:
+  explicit CfgThinner(const graph_t& g);
+
+  // Sets nbhrs to the branches at distance one from src, in increasing
+  // order.  If reached is given, it is set to all of the nodes the
+  // search reached.
+  void BranchNeighbors(int src, const vector<bool>& is_branch,
+                       vector<int>* nbhrs, vector<int>* reached = NULL);
+
+  // The number of nodes reached by all searches so far.
+  size_t num_nodes_reached() const { return num_nodes_reached_; }
+
+ private:
+  const graph_t& g_;
+  vector<unsigned char> dist_;  // (Distances are at most one.)
+  vector<int> touched_;
+  deque< pair<size_t,int> > queue_;
+  size_t num_nodes_reached_;
+};
+
+// Thins the CFG for every given branch, in parallel.  The thinned
+// edges are returned in cfg_branches format -- for each branch, its id,
+// its number of neighbors, and its neighbors -- as a sequence of
+// records which, concatenated, list the branches in the given order.
+// Returns the number of thinned edges.
+size_t ThinBranchCfg(const graph_t& g, const vector<int>& branches,
+                     const vector<bool>& is_branch, vector<string>* records);
+
+}  // namespace crest
+
+#endif  // PROCESS_CFG_THIN_CFG_H__
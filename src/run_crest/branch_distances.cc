@@ -0,0 +1,164 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "run_crest/branch_distances.h"
+
+using std::greater;
+using std::make_pair;
+using std::pair;
+using std::priority_queue;
+using std::queue;
+
+namespace crest {
+
+typedef vector<branch_id_t>::const_iterator BranchIt;
+typedef ConstArray<branch_id_t>::const_iterator NbhrIt;
+
+
+BranchDistances::BranchDistances(const ConstArray<branch_id_t>& branches,
+                                 const BranchGraph& cfg,
+                                 const BranchGraph& cfg_rev)
+  : branches_(branches), cfg_(cfg), cfg_rev_(cfg_rev),
+    dist_(cfg.size()), affected_(cfg.size(), false),
+    num_full_updates_(0), num_incremental_updates_(0),
+    num_nodes_recomputed_(0) { }
+
+
+void BranchDistances::Update(const vector<bool>& covered) {
+  if (covered_.size() != covered.size()) {
+    Recompute(covered);
+    return;
+  }
+
+  vector<branch_id_t> newly_covered;
+  for (NbhrIt i = branches_.begin(); i != branches_.end(); ++i) {
+    if (covered[*i] == covered_[*i])
+      continue;
+    if (!covered[*i]) {
+      // Coverage shrank, so start over.
+      Recompute(covered);
+      return;
+    }
+    newly_covered.push_back(*i);
+  }
+
+  if (!newly_covered.empty()) {
+    Cover(newly_covered);
+  }
+}
+
+
+void BranchDistances::Recompute(const vector<bool>& covered) {
+  num_full_updates_++;
+  covered_ = covered;
+
+  // We run a BFS backward, starting simultaneously at all uncovered vertices.
+  queue<branch_id_t> Q;
+  for (NbhrIt i = branches_.begin(); i != branches_.end(); ++i) {
+    if (!covered_[*i]) {
+      dist_[*i] = 0;
+      Q.push(*i);
+    } else {
+      dist_[*i] = kInfiniteDistance;
+    }
+  }
+
+  while (!Q.empty()) {
+    branch_id_t i = Q.front();
+    size_t dist_i = dist_[i];
+    Q.pop();
+
+    for (NbhrIt j = cfg_rev_[i].begin(); j != cfg_rev_[i].end(); ++j) {
+      if (dist_i + 1 < dist_[*j]) {
+	dist_[*j] = dist_i + 1;
+	Q.push(*j);
+      }
+    }
+  }
+}
+
+
+void BranchDistances::Cover(const vector<branch_id_t>& newly_covered) {
+  num_incremental_updates_++;
+
+  // (1) Find the affected branches: those with no shortest path to an
+  // uncovered branch that avoids the newly covered ones.  Branches are
+  // visited in order of their old distance, so a branch's successors
+  // one step closer have all been classified before the branch is.
+  vector<branch_id_t> affected;
+  for (BranchIt i = newly_covered.begin(); i != newly_covered.end(); ++i) {
+    covered_[*i] = true;
+    affected_[*i] = true;
+    affected.push_back(*i);
+  }
+
+  for (size_t k = 0; k < affected.size(); k++) {
+    const branch_id_t u = affected[k];
+    for (NbhrIt p = cfg_rev_[u].begin(); p != cfg_rev_[u].end(); ++p) {
+      if (affected_[*p] || (dist_[*p] != dist_[u] + 1))
+        continue;
+
+      // Is there still a shortest path from p, through some other
+      // successor?
+      bool supported = false;
+      for (NbhrIt w = cfg_[*p].begin(); w != cfg_[*p].end(); ++w) {
+        if (!affected_[*w] && (dist_[*w] + 1 == dist_[*p])) {
+          supported = true;
+          break;
+        }
+      }
+      if (!supported) {
+        affected_[*p] = true;
+        affected.push_back(*p);
+      }
+    }
+  }
+
+  // (2) Recompute the distances of the affected branches: start each
+  // from its best unaffected successor, and then propagate (shortest
+  // first) among the affected branches.
+  typedef pair<size_t,branch_id_t> DistBranch;
+  priority_queue<DistBranch, vector<DistBranch>, greater<DistBranch> > Q;
+  for (BranchIt a = affected.begin(); a != affected.end(); ++a) {
+    size_t d = kInfiniteDistance;
+    for (NbhrIt w = cfg_[*a].begin(); w != cfg_[*a].end(); ++w) {
+      if (!affected_[*w] && (dist_[*w] + 1 < d))
+        d = dist_[*w] + 1;
+    }
+    dist_[*a] = d;
+    if (d < kInfiniteDistance)
+      Q.push(make_pair(d, *a));
+  }
+
+  while (!Q.empty()) {
+    size_t d = Q.top().first;
+    branch_id_t i = Q.top().second;
+    Q.pop();
+    if (d != dist_[i])
+      continue;
+
+    for (NbhrIt j = cfg_rev_[i].begin(); j != cfg_rev_[i].end(); ++j) {
+      if (affected_[*j] && (d + 1 < dist_[*j])) {
+        dist_[*j] = d + 1;
+        Q.push(make_pair(d + 1, *j));
+      }
+    }
+  }
+
+  for (BranchIt a = affected.begin(); a != affected.end(); ++a)
+    affected_[*a] = false;
+  num_nodes_recomputed_ += affected.size();
+}
+
+}  // namespace crest
@@ -0,0 +1,73 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_BRANCH_DISTANCES_H__
+#define RUN_CREST_BRANCH_DISTANCES_H__
+
+#include <vector>
+
+#include "base/basic_types.h"
+#include "base/program_bundle.h"
+
+using std::vector;
+
+namespace crest {
+
+// The distance, for every branch, along the branch CFG to the nearest
+// uncovered branch (zero for uncovered branches themselves).
+//
+// As coverage only grows, distances only grow, and an update is done
+// incrementally: the branches whose shortest paths all ran through a
+// newly covered branch are found, and only their distances are
+// recomputed.  When coverage shrinks (e.g. on a restart), all
+// distances are recomputed with a full backward BFS.
+class BranchDistances {
+ public:
+  static const size_t kInfiniteDistance = 10000;
+
+  // The branches, the CFG and the reversed CFG are views, and the
+  // tables they point into must outlive this object.
+  BranchDistances(const ConstArray<branch_id_t>& branches,
+                  const BranchGraph& cfg, const BranchGraph& cfg_rev);
+
+  // Brings the distances up to date with the given coverage.
+  void Update(const vector<bool>& covered);
+
+  // Recomputes all distances from scratch.
+  void Recompute(const vector<bool>& covered);
+
+  size_t operator[](branch_id_t b) const { return dist_[b]; }
+
+  // Stats.
+  unsigned num_full_updates() const { return num_full_updates_; }
+  unsigned num_incremental_updates() const { return num_incremental_updates_; }
+  size_t num_nodes_recomputed() const { return num_nodes_recomputed_; }
+
+ private:
+  const ConstArray<branch_id_t> branches_;
+  const BranchGraph cfg_;
+  const BranchGraph cfg_rev_;
+
+  vector<size_t> dist_;
+  vector<bool> covered_;  // The coverage the distances are for.
+
+  // Scratch space for incremental updates.
+  vector<bool> affected_;
+
+  unsigned num_full_updates_;
+  unsigned num_incremental_updates_;
+  size_t num_nodes_recomputed_;
+
+  void Cover(const vector<branch_id_t>& newly_covered);
+};
+
+}  // namespace crest
+
+#endif  // RUN_CREST_BRANCH_DISTANCES_H__
@@ -0,0 +1,81 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_CHECKPOINT_H__
+#define RUN_CREST_CHECKPOINT_H__
+
+#include <istream>
+#include <string>
+#include <vector>
+
+using std::istream;
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// Helpers for writing and reading the fields of the driver's binary
+// checkpoints.  Values are written in native byte order -- a
+// checkpoint is only meant to be resumed on the machine that wrote it.
+
+template <typename T>
+inline void WriteRaw(string* s, const T& x) {
+  s->append(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+template <typename T>
+inline bool ReadRaw(istream& in, T* x) {
+  return in.read(reinterpret_cast<char*>(x), sizeof(T)).good();
+}
+
+inline void WriteString(string* s, const string& str) {
+  WriteRaw(s, static_cast<unsigned long long>(str.size()));
+  s->append(str);
+}
+
+inline bool ReadString(istream& in, string* str) {
+  unsigned long long len;
+  if (!ReadRaw(in, &len))
+    return false;
+  str->resize(len);
+  return (len == 0) || in.read(&(*str)[0], len).good();
+}
+
+inline void WriteBits(string* s, const vector<bool>& bits) {
+  WriteRaw(s, static_cast<unsigned long long>(bits.size()));
+  unsigned char byte = 0;
+  for (size_t i = 0; i < bits.size(); i++) {
+    if (bits[i])
+      byte |= (1 << (i % 8));
+    if ((i % 8 == 7) || (i + 1 == bits.size())) {
+      s->push_back(byte);
+      byte = 0;
+    }
+  }
+}
+
+inline bool ReadBits(istream& in, vector<bool>* bits) {
+  unsigned long long len;
+  if (!ReadRaw(in, &len))
+    return false;
+  string bytes;
+  bytes.resize((len + 7) / 8);
+  if ((len > 0) && !in.read(&bytes[0], bytes.size()).good())
+    return false;
+  bits->resize(len);
+  for (size_t i = 0; i < len; i++) {
+    (*bits)[i] = (bytes[i / 8] >> (i % 8)) & 1;
+  }
+  return true;
+}
+
+}  // namespace crest
+
+#endif  // RUN_CREST_CHECKPOINT_H__
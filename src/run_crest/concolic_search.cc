@@ -11,20 +11,34 @@
 #include <algorithm>
 #include <assert.h>
 #include <cmath>
+#include <dirent.h>
+#include <errno.h>
 #include <fstream>
 #include <functional>
 #include <limits>
 #include <stdio.h>
 #include <stdlib.h>
 #include <queue>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <typeinfo>
+#include <unistd.h>
 #include <utility>
 
+#include "base/input_file.h"
 #include "base/z3_solver.h"
+#include "run_crest/checkpoint.h"
 #include "run_crest/concolic_search.h"
 
 using std::binary_function;
+using std::binary_search;
+using std::equal;
+using std::find;
 using std::ifstream;
 using std::ios;
+using std::istringstream;
 using std::min;
 using std::max;
 using std::numeric_limits;
@@ -37,6 +51,61 @@ namespace crest {
 
 namespace {
 
+// Limits on the size of the shared set of path prefixes, and of the
+// set of the paths of all runs.
+const size_t kMaxPrefixes = 1 << 22;
+const size_t kMaxKnownPaths = 1 << 22;
+
+const char kCheckpointMagic[8] = { 'C', 'R', 'E', 'S', 'T', 'C', 'K', '3' };
+
+// Seeds are ordered by the length of their names, and then by name,
+// so that input.N files are replayed in order.
+bool SeedNameLess(const string& a, const string& b) {
+  return (a.size() < b.size()) || ((a.size() == b.size()) && (a < b));
+}
+
+// Reads the seed inputs in a directory (see Search::set_seeds).
+void ReadSeeds(const string& dir, vector< vector<value_t> >* seeds) {
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    fprintf(stderr, "Failed to open seed directory %s.\n", dir.c_str());
+    return;
+  }
+
+  vector<string> names;
+  while (struct dirent* e = readdir(d)) {
+    const string name = e->d_name;
+    const string path = dir + "/" + name;
+    struct stat st;
+    if ((stat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode))
+      continue;
+
+    bool is_input = (name == "input") || (name.compare(0, 6, "input.") == 0);
+    if (!is_input) {
+      // Any other file must be in the binary input format.
+      char magic[sizeof(kInputFileMagic)];
+      FILE* f = fopen(path.c_str(), "rb");
+      is_input = f && (fread(magic, 1, sizeof(magic), f) == sizeof(magic))
+        && !memcmp(magic, kInputFileMagic, sizeof(magic));
+      if (f)
+        fclose(f);
+    }
+    if (is_input)
+      names.push_back(name);
+  }
+  closedir(d);
+  sort(names.begin(), names.end(), SeedNameLess);
+
+  for (size_t i = 0; i < names.size(); i++) {
+    InputFile in;
+    if (!in.Open(dir + "/" + names[i])) {
+      fprintf(stderr, "Skipping malformed seed %s.\n", names[i].c_str());
+      continue;
+    }
+    seeds->push_back(vector<value_t>(in.values(), in.values() + in.size()));
+  }
+}
+
 typedef pair<size_t,int> ScoredBranch;
 
 struct ScoredBranchComp
@@ -54,53 +123,36 @@ struct ScoredBranchComp
 //// Search ////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
 
+volatile sig_atomic_t Search::stop_requested_ = 0;
+
 Search::Search(const string& program, int max_iterations)
-  : program_(program), max_iters_(max_iterations), num_iters_(0) {
+  : program_(program), max_iters_(max_iterations), num_iters_(0),
+    text_input_(false), time_budget_(0), plateau_time_(0),
+    checkpoint_interval_(0),
+    num_prefix_solves_saved_(0), num_prefix_runs_saved_(0),
+    num_known_path_runs_(0), seeds_replayed_(false), cache_(64 << 20),
+    num_flips_skipped_(0), shared_(NULL), importing_(false) {
 
   start_time_ = time(NULL);
+  budget_start_time_ = start_time_;
+  last_new_coverage_time_ = start_time_;
+  last_checkpoint_time_ = start_time_;
+  resumed_ = false;
 
-  { // Read in the set of branches.
-    max_branch_ = 0;
-    max_function_ = 0;
-    branches_.reserve(100000);
-    branch_count_.reserve(100000);
-    branch_count_.push_back(0);
-
-    ifstream in("branches");
-    assert(in);
-    function_id_t fid;
-    int numBranches;
-    while (in >> fid >> numBranches) {
-      branch_count_.push_back(2 * numBranches);
-      branch_id_t b1, b2;
-      for (int i = 0; i < numBranches; i++) {
-	assert(in >> b1 >> b2);
-	branches_.push_back(b1);
-	branches_.push_back(b2);
-	max_branch_ = max(max_branch_, max(b1, b2));
-      }
-    }
-    in.close();
-    max_branch_ ++;
-    max_function_ = branch_count_.size();
-  }
+  // By default, pending executions may hold up to 1GB.
+  max_worklist_bytes_ = 1 << 30;
 
-  // Compute the paired-branch map.
-  paired_branch_.resize(max_branch_);
-  for (size_t i = 0; i < branches_.size(); i += 2) {
-    paired_branch_[branches_[i]] = branches_[i+1];
-    paired_branch_[branches_[i+1]] = branches_[i];
-  }
-
-  // Compute the branch-to-function map.
-  branch_function_.resize(max_branch_);
-  { size_t i = 0;
-    for (function_id_t j = 0; j < branch_count_.size(); j++) {
-      for (size_t k = 0; k < branch_count_[j]; k++) {
-	branch_function_[branches_[i++]] = j;
-      }
-    }
+  // Read in the branches (and the branch CFG, if there is one).
+  if (!bundle_.Open("program_bundle", "branches", "cfg_branches")) {
+    fprintf(stderr, "Failed to read the branches of the program.\n");
+    exit(-1);
   }
+  branches_ = bundle_.branches();
+  paired_branch_ = bundle_.paired_branch();
+  branch_function_ = bundle_.branch_function();
+  branch_count_ = bundle_.branch_count();
+  max_branch_ = bundle_.max_branch();
+  max_function_ = bundle_.max_function();
 
   // Initialize all branches to "uncovered" (and functions to "unreached").
   total_num_covered_ = num_covered_ = 0;
@@ -109,31 +161,9 @@ Search::Search(const string& program, int max_iterations)
   total_covered_.resize(max_branch_, false);
   reached_.resize(max_function_, false);
 
-#if 0
-  { // Read in any previous coverage (for faster debugging).
-    ifstream in("coverage");
-    branch_id_t bid;
-    while (in >> bid) {
-      covered_[bid] = true;
-      num_covered_ ++;
-      if (!reached_[branch_function_[bid]]) {
-	reached_[branch_function_[bid]] = true;
-	reachable_functions_ ++;
-	reachable_branches_ += branch_count_[branch_function_[bid]];
-      }
-    }
-
-    total_num_covered_ = 0;
-    total_covered_ = covered_;
-  }
-#endif
-
   // Print out the initial coverage.
   fprintf(stderr, "Iteration 0 (0s): covered %u branches [%u reach funs, %u reach branches].\n",
           num_covered_, reachable_functions_, reachable_branches_);
-
-  // Sort the branches.
-  sort(branches_.begin(), branches_.end());
 }
 
 
@@ -142,18 +172,11 @@ Search::~Search() { }
 
 void Search::WriteInputToFileOrDie(const string& file,
 				   const vector<value_t>& input) {
-  FILE* f = fopen(file.c_str(), "w");
-  if (!f) {
-    fprintf(stderr, "Failed to open %s.\n", file.c_str());
+  if (!WriteInputFile(file, input, text_input_)) {
+    fprintf(stderr, "Failed to write %s.\n", file.c_str());
     perror("Error: ");
     exit(-1);
   }
-
-  for (size_t i = 0; i < input.size(); i++) {
-    fprintf(f, "%lld\n", input[i]);
-  }
-
-  fclose(f);
 }
 
 
@@ -165,7 +188,7 @@ void Search::WriteCoverageToFileOrDie(const string& file) {
     exit(-1);
   }
 
-  for (BranchIt i = branches_.begin(); i != branches_.end(); ++i) {
+  for (BranchTableIt i = branches_.begin(); i != branches_.end(); ++i) {
     if (total_covered_[*i]) {
       fprintf(f, "%d\n", *i);
     }
@@ -188,28 +211,250 @@ void Search::LaunchProgram(const vector<value_t>& inputs) {
   }
   */
 
-  system(program_.c_str());
+  int status = system(program_.c_str());
+
+  // While the program runs, system() ignores SIGINT in this process, so
+  // notice if it killed the program instead.
+  if ((status != -1) && WIFSIGNALED(status) && (WTERMSIG(status) == SIGINT)) {
+    RequestStop();
+  }
 }
 
 
-void Search::RunProgram(const vector<value_t>& inputs, SymbolicExecution* ex) {
-  if (++num_iters_ > max_iters_) {
-    // TODO(jburnim): Devise a better system for capping the iterations.
-    exit(0);
+const char* Search::StopReason() const {
+  if (stop_requested_)
+    return "interrupted";
+  if (num_iters_ >= max_iters_)
+    return "iteration limit reached";
+
+  const time_t now = time(NULL);
+  if ((time_budget_ > 0) && (now - budget_start_time_ >= time_budget_))
+    return "time budget exhausted";
+  if ((plateau_time_ > 0) && (now - last_new_coverage_time_ >= plateau_time_))
+    return "coverage plateaued";
+
+  return NULL;
+}
+
+
+void Search::Finish(const char* reason) {
+  // Everything up to the last complete run has already been saved
+  // (inputs as input.N files), so just flush the coverage and stats.
+  WriteCoverageToFileOrDie("coverage");
+  if (checkpoint_interval_ > 0) {
+    SaveCheckpoint("checkpoint");
+  }
+  PrintStats();
+  fprintf(stderr, "Explored prefixes: %zu (saved %u solves and %u runs).\n",
+          prefixes_.size(), num_prefix_solves_saved_, num_prefix_runs_saved_);
+  fprintf(stderr, "Known paths: %zu (%u runs not parsed).\n",
+          known_paths_.size(), num_known_path_runs_);
+  fprintf(stderr, "Execution cache: %u hits (%zu entries, %zu bytes).\n",
+          cache_.num_hits(), cache_.size(), cache_.bytes());
+  fprintf(stderr, "Failed flips: %zu (%u flips skipped, %zu tracked).\n",
+          flip_stats_.num_failures(), num_flips_skipped_, flip_stats_.size());
+  fprintf(stderr, "Finished (%s) after %d iterations (%lds): "
+          "covered %u branches [%u reach funs, %u reach branches].\n",
+          reason, num_iters_, time(NULL)-start_time_,
+          total_num_covered_, reachable_functions_, reachable_branches_);
+  exit(0);
+}
+
+
+static void CorruptCheckpoint(const string& file) {
+  fprintf(stderr, "Checkpoint %s is corrupt.\n", file.c_str());
+  exit(-1);
+}
+
+
+void Search::SaveCheckpoint(const string& file) {
+  string s;
+  s.append(kCheckpointMagic, sizeof(kCheckpointMagic));
+  WriteRaw(&s, max_branch_);
+  WriteRaw(&s, max_function_);
+  WriteString(&s, typeid(*this).name());
+
+  WriteRaw(&s, num_iters_);
+  WriteRaw(&s, static_cast<long long>(time(NULL) - start_time_));
+  WriteRaw(&s, num_covered_);
+  WriteRaw(&s, total_num_covered_);
+  WriteRaw(&s, reachable_functions_);
+  WriteRaw(&s, reachable_branches_);
+  WriteBits(&s, covered_);
+  WriteBits(&s, total_covered_);
+  WriteBits(&s, reached_);
+
+  // A flip which has been solved may not have been run yet -- all of an
+  // execution's flips are solved before their children are run, and the
+  // search may stop before running them -- so such prefixes are not saved,
+  // and are solved and run again after resuming.  (Once a child has run
+  // along its flip, the prefix is marked as explored.)
+  string prefixes;
+  unsigned long long num_prefixes = 0;
+  typedef hash_map<path_hash_t, char, PathHashHasher>::const_iterator PrefixIt;
+  for (PrefixIt i = prefixes_.begin(); i != prefixes_.end(); ++i) {
+    if (i->second == kPrefixSat)
+      continue;
+    WriteRaw(&prefixes, i->first);
+    WriteRaw(&prefixes, i->second);
+    num_prefixes++;
+  }
+  WriteRaw(&s, num_prefixes);
+  s.append(prefixes);
+  WriteRaw(&s, num_prefix_solves_saved_);
+  WriteRaw(&s, num_prefix_runs_saved_);
+  flip_stats_.Save(&s);
+  WriteRaw(&s, num_flips_skipped_);
+
+  SaveState(&s);
+
+  // Write to a temporary file and then rename it, so that an existing
+  // checkpoint is never left half-written.  A failed checkpoint is not
+  // fatal.
+  string tmp = file + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f || (fwrite(s.data(), 1, s.size(), f) != s.size())) {
+    fprintf(stderr, "Failed to write checkpoint %s.\n", tmp.c_str());
+    if (f)
+      fclose(f);
+    return;
   }
+  fclose(f);
+  rename(tmp.c_str(), file.c_str());
+  last_checkpoint_time_ = time(NULL);
+}
+
+
+bool Search::Resume(const string& file) {
+  ifstream in(file.c_str(), ios::in | ios::binary);
+  if (!in)
+    return false;
+
+  char magic[sizeof(kCheckpointMagic)];
+  branch_id_t max_branch;
+  function_id_t max_function;
+  string strategy;
+  if (!in.read(magic, sizeof(magic))
+      || !equal(magic, magic + sizeof(magic), kCheckpointMagic)
+      || !ReadRaw(in, &max_branch) || (max_branch != max_branch_)
+      || !ReadRaw(in, &max_function) || (max_function != max_function_)) {
+    fprintf(stderr, "Checkpoint %s is not for this program.\n", file.c_str());
+    return false;
+  }
+  if (!ReadString(in, &strategy) || (strategy != typeid(*this).name())) {
+    fprintf(stderr, "Checkpoint %s is for a different strategy.\n",
+            file.c_str());
+    return false;
+  }
+
+  // Past this point, the search state has been partially overwritten,
+  // so a bad checkpoint is fatal.
+  long long elapsed;
+  unsigned long long num_prefixes;
+  if (!ReadRaw(in, &num_iters_) || !ReadRaw(in, &elapsed)
+      || !ReadRaw(in, &num_covered_) || !ReadRaw(in, &total_num_covered_)
+      || !ReadRaw(in, &reachable_functions_) || !ReadRaw(in, &reachable_branches_)
+      || !ReadBits(in, &covered_) || !ReadBits(in, &total_covered_)
+      || !ReadBits(in, &reached_) || !ReadRaw(in, &num_prefixes)) {
+    CorruptCheckpoint(file);
+  }
+  for (unsigned long long i = 0; i < num_prefixes; i++) {
+    path_hash_t h;
+    char state;
+    if (!ReadRaw(in, &h) || !ReadRaw(in, &state))
+      CorruptCheckpoint(file);
+    prefixes_[h] = state;
+  }
+  if (!ReadRaw(in, &num_prefix_solves_saved_)
+      || !ReadRaw(in, &num_prefix_runs_saved_)
+      || !flip_stats_.Load(in) || !ReadRaw(in, &num_flips_skipped_)
+      || !LoadState(in)) {
+    CorruptCheckpoint(file);
+  }
+  in.close();
+
+  start_time_ = time(NULL) - elapsed;
+  resumed_ = true;
+  fprintf(stderr, "Resumed at iteration %d (%llds): covered %u branches [%u reach funs, %u reach branches].\n",
+          num_iters_, elapsed, total_num_covered_,
+          reachable_functions_, reachable_branches_);
+  return true;
+}
+
+
+bool Search::RunProgram(const vector<value_t>& inputs, SymbolicExecution* ex,
+                        bool skip_known_path) {
+  if (const char* reason = StopReason()) {
+    Finish(reason);
+  }
+  if ((checkpoint_interval_ > 0)
+      && (time(NULL) - last_checkpoint_time_ >= checkpoint_interval_)) {
+    SaveCheckpoint("checkpoint");
+  }
+  if (shared_ && !importing_) {
+    ImportSharedInputs();
+  }
+  ++num_iters_;
+
   // Save the given inputs.
   char fname[32];
   snprintf(fname, 32, "input.%d", num_iters_);
   WriteInputToFileOrDie(fname, inputs);
 
-  // Run the program.
-  LaunchProgram(inputs);
+  // An input which has already been run need not be run again.
+  const string* execution = cache_.Lookup(inputs);
+  string launched;
+  if (!execution) {
+    // Run the program.  (If we were interrupted during the run, its
+    // execution may be incomplete, so discard it.)
+    LaunchProgram(inputs);
+    if (stop_requested_) {
+      Finish("interrupted");
+    }
 
-  // Read the execution from the program.
-  // Want to do this with sockets.  (Currently doing it with files.)
-  ifstream in("szd_execution", ios::in | ios::binary);
-  assert(in && ex->Parse(in));
-  in.close();
+    // Read the execution from the program.
+    // Want to do this with sockets.  (Currently doing it with files.)
+    ifstream in("szd_execution", ios::in | ios::binary);
+    if (in) {
+      in.seekg(0, ios::end);
+      launched.resize(in.tellg());
+      in.seekg(0, ios::beg);
+    }
+    if (!in || (!launched.empty() && !in.read(&launched[0], launched.size()))) {
+      fprintf(stderr, "Failed to read szd_execution.\n");
+      exit(-1);
+    }
+    in.close();
+    execution = &launched;
+  }
+
+  // The execution starts with the hash of its path, so a path which has
+  // already been seen can be recognized without parsing it.
+  path_hash_t hash;
+  const bool have_hash = SymbolicExecution::ParsePathHash(*execution, &hash);
+  if (skip_known_path && have_hash
+      && (known_paths_.find(hash) != known_paths_.end())) {
+    num_known_path_runs_++;
+    return false;
+  }
+
+  { istringstream in(*execution);
+    if (!ex->Parse(in)) {
+      fprintf(stderr, "Failed to parse execution %d.\n", num_iters_);
+      exit(-1);
+    }
+  }
+  if (have_hash && (known_paths_.size() < kMaxKnownPaths)) {
+    known_paths_.insert(hash);
+  }
+
+  // Only an execution which read no values beyond the given input (the
+  // runtime fills in random ones) is sure to be repeated by the input.
+  if ((execution == &launched) && (ex->inputs().size() == inputs.size())) {
+    cache_.Insert(inputs, launched);
+  }
+
+  RecordExploredPrefixes(*ex);
 
   /*
   for (size_t i = 0; i < ex->path().branches().size(); i++) {
@@ -217,9 +462,196 @@ void Search::RunProgram(const vector<value_t>& inputs, SymbolicExecution* ex) {
   }
   fprintf(stderr, "\n");
   */
+  return true;
 }
   
 
+void Search::ImportSharedInputs() {
+  vector< vector<value_t> > inputs;
+  shared_->Poll(&inputs);
+  if (inputs.empty())
+    return;
+
+  importing_ = true;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    SymbolicExecution* ex = new SymbolicExecution();
+    if (!RunProgram(inputs[i], ex, true)) {
+      delete ex;
+      continue;
+    }
+    UpdateCoverage(*ex);
+    ImportExecution(ex);
+  }
+  importing_ = false;
+
+  // Adopt the coverage found by the other workers (including coverage
+  // from inputs that were too large to share).
+  for (BranchTableIt i = branches_.begin(); i != branches_.end(); ++i) {
+    if (!shared_->IsCovered(*i))
+      continue;
+    if (!covered_[*i]) {
+      covered_[*i] = true;
+      num_covered_++;
+      if (!reached_[branch_function_[*i]]) {
+	reached_[branch_function_[*i]] = true;
+	reachable_functions_ ++;
+	reachable_branches_ += branch_count_[branch_function_[*i]];
+      }
+    }
+    if (!total_covered_[*i]) {
+      total_covered_[*i] = true;
+      total_num_covered_++;
+    }
+  }
+}
+
+
+bool Search::InitialExecution(SymbolicExecution* ex,
+                              set<branch_id_t>* new_branches) {
+  vector< vector<value_t> > seeds;
+  if (!seed_dir_.empty() && !seeds_replayed_ && !resumed_) {
+    ReadSeeds(seed_dir_, &seeds);
+    fprintf(stderr, "Replaying %zu seeds from %s.\n",
+            seeds.size(), seed_dir_.c_str());
+  }
+  seeds_replayed_ = true;
+
+  vector<SymbolicExecution*> exs;
+  ReplayInputs(seeds, &exs);
+  if (exs.empty()) {
+    RunProgram(vector<value_t>(), ex);
+    return UpdateCoverage(*ex, new_branches);
+  }
+
+  // Record the coverage of every seed, scoring each by the number of
+  // branches it newly covers (and then by its number of constraints).
+  bool found_new_branch = false;
+  vector<size_t> scores(exs.size());
+  size_t best = 0;
+  set<branch_id_t> best_new_branches;
+  for (size_t i = 0; i < exs.size(); i++) {
+    set<branch_id_t> seed_new_branches;
+    found_new_branch |= UpdateCoverage(*exs[i], &seed_new_branches);
+    scores[i] = seed_new_branches.size();
+    if ((i == 0) || (scores[i] > scores[best])
+        || ((scores[i] == scores[best])
+            && (exs[i]->path().constraints().size()
+                > exs[best]->path().constraints().size()))) {
+      best = i;
+      best_new_branches.swap(seed_new_branches);
+    }
+  }
+
+  ex->Swap(*exs[best]);
+  delete exs[best];
+  if (new_branches) {
+    new_branches->insert(best_new_branches.begin(), best_new_branches.end());
+  }
+  for (size_t i = 0; i < exs.size(); i++) {
+    if (i != best)
+      AddSeedExecution(exs[i], scores[i]);
+  }
+  return found_new_branch;
+}
+
+
+void Search::ReplayInputs(const vector< vector<value_t> >& inputs,
+                          vector<SymbolicExecution*>* exs) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const size_t num_jobs = (num_cpus > 0) ? num_cpus : 1;
+
+  // The replays run in subdirectories, so a relative path to the
+  // program must be made absolute.
+  string program = program_;
+  if ((program.find('/') != string::npos) && (program[0] != '/')) {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)))
+      program = string(cwd) + "/" + program;
+  }
+
+  for (size_t start = 0; start < inputs.size(); start += num_jobs) {
+    if (const char* reason = StopReason()) {
+      Finish(reason);
+    }
+    const size_t n = min(min(num_jobs, inputs.size() - start),
+                         static_cast<size_t>(max_iters_ - num_iters_));
+
+    vector<pid_t> pids(n, -1);
+    for (size_t k = 0; k < n; k++) {
+      // Save the input, as for any other run.
+      ++num_iters_;
+      char fname[32];
+      snprintf(fname, 32, "input.%d", num_iters_);
+      WriteInputToFileOrDie(fname, inputs[start + k]);
+
+      char dir[32];
+      snprintf(dir, sizeof(dir), "replay.%zu", k);
+      if ((mkdir(dir, 0777) != 0) && (errno != EEXIST)) {
+        perror("Failed to create replay directory");
+        exit(-1);
+      }
+      WriteInputToFileOrDie(string(dir) + "/input", inputs[start + k]);
+      unlink((string(dir) + "/szd_execution").c_str());
+
+      pids[k] = fork();
+      if (pids[k] == 0) {
+        if (chdir(dir) == 0) {
+          execl("/bin/sh", "sh", "-c", program.c_str(), (char*)NULL);
+        }
+        _exit(127);
+      }
+    }
+
+    for (size_t k = 0; k < n; k++) {
+      int status;
+      if ((pids[k] > 0) && (waitpid(pids[k], &status, 0) == pids[k])
+          && WIFSIGNALED(status) && (WTERMSIG(status) == SIGINT)) {
+        RequestStop();
+      }
+    }
+    if (stop_requested_) {
+      Finish("interrupted");
+    }
+
+    for (size_t k = 0; k < n; k++) {
+      char fname[48];
+      snprintf(fname, sizeof(fname), "replay.%zu/szd_execution", k);
+      SymbolicExecution* ex = new SymbolicExecution();
+      ifstream in(fname, ios::in | ios::binary);
+      if (!in || !ex->Parse(in)) {
+        fprintf(stderr, "Failed to replay input %zu.\n", start + k);
+        delete ex;
+        continue;
+      }
+      if (known_paths_.size() < kMaxKnownPaths) {
+        known_paths_.insert(ex->path().path_hash());
+      }
+      RecordExploredPrefixes(*ex);
+      exs->push_back(ex);
+    }
+  }
+}
+
+
+void Search::RecordExploredPrefixes(const SymbolicExecution& ex) {
+  const SymbolicPath& path = ex.path();
+  const vector<path_hash_t>& hashes = path.prefix_hashes();
+
+#pragma omp critical(crest_prefixes)
+  for (size_t i = 0; i < hashes.size(); i++) {
+    branch_id_t bid = path.branches()[path.constraints_idx()[i]];
+    path_hash_t h = ExtendPathHash(hashes[i], bid);
+    if (prefixes_.size() < kMaxPrefixes) {
+      prefixes_[h] = kPrefixExplored;
+    } else {
+      hash_map<path_hash_t, char, PathHashHasher>::iterator it = prefixes_.find(h);
+      if (it != prefixes_.end())
+        it->second = kPrefixExplored;
+    }
+  }
+}
+
+
 bool Search::UpdateCoverage(const SymbolicExecution& ex) {
   return UpdateCoverage(ex, NULL);
 }
@@ -228,6 +660,7 @@ bool Search::UpdateCoverage(const SymbolicExecution& ex,
 			    set<branch_id_t>* new_branches) {
 
   const unsigned int prev_covered_ = num_covered_;
+  bool found_global_branch = false;
   const vector<branch_id_t>& branches = ex.path().branches();
   for (BranchIt i = branches.begin(); i != branches.end(); ++i) {
     if ((*i > 0) && !covered_[*i]) {
@@ -245,9 +678,17 @@ bool Search::UpdateCoverage(const SymbolicExecution& ex,
     if ((*i > 0) && !total_covered_[*i]) {
       total_covered_[*i] = true;
       total_num_covered_++;
+      last_new_coverage_time_ = time(NULL);
+      if (shared_ && shared_->Cover(*i))
+        found_global_branch = true;
     }
   }
 
+  // Share any input which covers a branch no worker has covered.
+  if (found_global_branch) {
+    shared_->Publish(ex.inputs());
+  }
+
   fprintf(stderr, "Iteration %d (%lds): covered %u branches [%u reach funs, %u reach branches].\n",
 	  num_iters_, time(NULL)-start_time_, total_num_covered_, reachable_functions_, reachable_branches_);
 
@@ -295,7 +736,7 @@ void Search::RandomInput(const map<var_t,type_t>& vars, vector<value_t>* input)
 
 
 bool Search::SolveAtBranch(const SymbolicExecution& ex,
-                           size_t branch_idx,
+                           size_t branch_idx, branch_id_t context,
                            vector<value_t>* input) {
 
   const vector<SymbolicPred*>& constraints = ex.path().constraints();
@@ -307,13 +748,71 @@ bool Search::SolveAtBranch(const SymbolicExecution& ex,
       return false;
   }
 
+  // Skip the flip if it has failed repeatedly, from any execution.
+  const SymbolicPath& path = ex.path();
+  const size_t path_idx = path.constraints_idx()[branch_idx];
+  const branch_id_t flip_target = paired_branch_[path.branches()[path_idx]];
+  bool skip = false;
+#pragma omp critical(crest_flip_stats)
+  {
+    skip = flip_stats_.ShouldSkip(flip_target, context);
+    if (skip)
+      num_flips_skipped_++;
+  }
+  if (skip)
+    return false;
+
+  // Skip the flip if some earlier run already took the flipped branch
+  // after this same prefix, or if the flip was already attempted.
+  bool check_prefix = (path.prefix_hashes().size() == constraints.size());
+  path_hash_t target = 0;
+  if (check_prefix) {
+    target = ExtendPathHash(path.prefix_hashes()[branch_idx], flip_target);
+    bool seen = false;
+#pragma omp critical(crest_prefixes)
+    {
+      hash_map<path_hash_t, char, PathHashHasher>::const_iterator it =
+        prefixes_.find(target);
+      if (it != prefixes_.end()) {
+        seen = true;
+        num_prefix_solves_saved_++;
+        if (it->second != kPrefixUnsat)
+          num_prefix_runs_saved_++;
+      } else if (prefixes_.size() < kMaxPrefixes) {
+        prefixes_[target] = kPrefixUnsat;
+      } else {
+        check_prefix = false;
+      }
+    }
+    if (seen)
+      return false;
+  }
+
+  // Solve with a negated copy of the branch_idx-th constraint, rather
+  // than negating it in place, so that several branches of the same
+  // execution can be solved concurrently.
+  const SymbolicPred& c = *constraints[branch_idx];
+  SymbolicPred negated(NegateCompareOp(c.op()), new SymbolicExpr(c.expr()));
   vector<const SymbolicPred*> cs(constraints.begin(),
-				 constraints.begin()+branch_idx+1);
+				 constraints.begin()+branch_idx);
+  cs.push_back(&negated);
   map<var_t,value_t> soln;
-  constraints[branch_idx]->Negate();
   bool success = Z3Solver::IncrementalSolve(ex.inputs(), ex.vars(), cs, &soln);
   fprintf(stderr, "%d\n", success);
-  constraints[branch_idx]->Negate();
+
+  if (!success) {
+#pragma omp critical(crest_flip_stats)
+    flip_stats_.RecordFailure(flip_target, context);
+  }
+
+  if (success && check_prefix) {
+#pragma omp critical(crest_prefixes)
+    {
+      char& state = prefixes_[target];
+      if (state == kPrefixUnsat)
+        state = kPrefixSat;
+    }
+  }
 
   if (success) {
     // Merge the solution with the previous input to get the next
@@ -341,13 +840,125 @@ bool Search::CheckPrediction(const SymbolicExecution& old_ex,
     return false;
   }
 
-   for (size_t j = 0; j < branch_idx; j++) {
-     if  (new_ex.path().branches()[j] != old_ex.path().branches()[j]) {
-       return false;
-     }
-   }
-   return (new_ex.path().branches()[branch_idx]
-           == paired_branch_[old_ex.path().branches()[branch_idx]]);
+  const vector<branch_id_t>& old_path = old_ex.path().branches();
+  const branch_id_t target = paired_branch_[old_path[branch_idx]];
+  bool predicted = (new_ex.path().branches()[branch_idx] == target);
+  for (size_t j = 0; predicted && (j < branch_idx); j++) {
+    if (new_ex.path().branches()[j] != old_path[j]) {
+      predicted = false;
+    }
+  }
+
+  return predicted;
+}
+
+
+bool Search::CheckFlip(const SymbolicExecution& old_ex,
+                       const SymbolicExecution& new_ex,
+                       size_t branch_idx, branch_id_t context) {
+  // A run which ended before reaching the flipped branch is a failure.
+  const bool predicted = CheckPrediction(old_ex, new_ex, branch_idx);
+  RecordFlip(old_ex, branch_idx, context, predicted);
+  return predicted;
+}
+
+
+void Search::RecordFlip(const SymbolicExecution& ex, size_t branch_idx,
+                        branch_id_t context, bool success) {
+  const vector<branch_id_t>& path = ex.path().branches();
+  if (branch_idx >= path.size())
+    return;
+  const branch_id_t target = paired_branch_[path[branch_idx]];
+#pragma omp critical(crest_flip_stats)
+  {
+    if (success) {
+      flip_stats_.RecordSuccess(target, context);
+    } else {
+      flip_stats_.RecordFailure(target, context);
+    }
+  }
+}
+
+
+unsigned Search::FlipPenalty(const SymbolicExecution& ex, size_t branch_idx,
+                             branch_id_t context) {
+  const vector<branch_id_t>& path = ex.path().branches();
+  const branch_id_t target =
+    paired_branch_[path[ex.path().constraints_idx()[branch_idx]]];
+  unsigned penalty;
+#pragma omp critical(crest_flip_stats)
+  penalty = flip_stats_.Penalty(target, context);
+  return penalty;
+}
+
+
+Search::PathIndex::PathIndex(const SymbolicExecution& ex)
+  : path(ex.path().branches()), thread(path.size()),
+    next(path.size(), path.size()), match(path.size(), path.size()),
+    failed(path.size(), 0) {
+  FlipStats::CallingContexts(ex.path(), &context);
+
+  const vector<size_t>& switches_idx = ex.path().thread_switches_idx();
+  const vector<unsigned int>& switches = ex.path().thread_switches();
+  vector< vector<size_t> > calls(1);  // The open calls of each thread.
+  vector<size_t> last(1, path.size());
+  unsigned int tid = 0;
+  for (size_t k = 0, s = 0; k < path.size(); k++) {
+    while ((s < switches.size()) && (switches_idx[s] <= k)) {
+      tid = switches[s++];
+      if (tid >= calls.size()) {
+        calls.resize(tid + 1);
+        last.resize(tid + 1, path.size());
+      }
+    }
+    thread[k] = tid;
+    if (last[tid] < path.size())
+      next[last[tid]] = k;
+    last[tid] = k;
+
+    if (path[k] == kCallId) {
+      calls[tid].push_back(k);
+    } else if ((path[k] == kReturnId) && !calls[tid].empty()) {
+      match[calls[tid].back()] = k;
+      calls[tid].pop_back();
+    }
+  }
+}
+
+
+void Search::CollectNextBranches
+(const PathIndex& index, size_t* pos, vector<size_t>* idxs) {
+  const vector<branch_id_t>& path = index.path;
+  // fprintf(stderr, "Collect(%u,%u,%u)\n", path.size(), *pos, idxs->size());
+
+  // Eat an arbitrary sequence of call-returns, collecting inside each one
+  // (and then jumping to its return).
+  while ((*pos < path.size()) && (path[*pos] == kCallId)) {
+    const size_t call = *pos;
+    *pos = index.next[call];
+    CollectNextBranches(index, pos, idxs);
+    *pos = index.match[call];
+    if (*pos >= path.size())
+      return;
+    assert(path[*pos] == kReturnId);
+    *pos = index.next[*pos];
+  }
+
+  // If the sequence of calls is followed by a branch, add it.
+  if ((*pos < path.size()) && (path[*pos] >= 0)) {
+    idxs->push_back(*pos);
+    *pos = index.next[*pos];
+    return;
+  }
+
+  // Alternatively, if the sequence is followed by a return, collect the branches
+  // immediately following the return.
+  /*
+  if ((*pos < path.size()) && (path[*pos] == kReturnId)) {
+    (*pos)++;
+    CollectNextBranches(index, pos, idxs);
+  }
+  */
 }
 
 
@@ -357,20 +968,48 @@ bool Search::CheckPrediction(const SymbolicExecution& old_ex,
 
 BoundedDepthFirstSearch::BoundedDepthFirstSearch
 (const string& program, int max_iterations, int max_depth)
-  : Search(program, max_iterations), max_depth_(max_depth) { }
+  : Search(program, max_iterations), max_depth_(max_depth),
+    worklist_(Worklist::DepthFirst, 0) {
+  current_.ex = NULL;
+}
 
-BoundedDepthFirstSearch::~BoundedDepthFirstSearch() { }
+BoundedDepthFirstSearch::~BoundedDepthFirstSearch() {
+  delete current_.ex;
+}
 
 void BoundedDepthFirstSearch::Run() {
-  // Initial execution (on empty/random inputs).
-  SymbolicExecution ex;
-  RunProgram(vector<value_t>(), &ex);
-  UpdateCoverage(ex);
+  // The depth-first search is done with an explicit stack of
+  // executions, each paired with the next of its constraints to try.
+  worklist_.set_max_bytes(max_worklist_bytes_);
+
+  if (worklist_.empty()) {
+    // Initial execution (on the seeds, or on empty/random inputs).
+    SymbolicExecution* ex = new SymbolicExecution();
+    InitialExecution(ex);
+    worklist_.Push(ex, 0, max_depth_, 0);
+  }
 
-  DFS(0, max_depth_, ex);
+  while (worklist_.Pop(&current_)) {
+    if (!DFS(&current_)) {
+      delete current_.ex;
+    }
+    current_.ex = NULL;
+  }
   // DFS(0, ex);
 }
 
+void BoundedDepthFirstSearch::ImportExecution(SymbolicExecution* ex) {
+  worklist_.Push(ex, 0, max_depth_, 0);
+}
+
+void BoundedDepthFirstSearch::SaveState(string* s) {
+  worklist_.Save(s, current_.ex ? &current_ : NULL);
+}
+
+bool BoundedDepthFirstSearch::LoadState(istream& in) {
+  return worklist_.Load(in);
+}
+
   /*
 void BoundedDepthFirstSearch::DFS(int depth, SymbolicExecution& prev_ex) {
   SymbolicExecution cur_ex;
@@ -403,33 +1042,49 @@ void BoundedDepthFirstSearch::DFS(int depth, SymbolicExecution& prev_ex) {
   */
 
 
-void BoundedDepthFirstSearch::DFS(size_t pos, int depth, SymbolicExecution& prev_ex) {
-  SymbolicExecution cur_ex;
+bool BoundedDepthFirstSearch::DFS(WorkItem* item) {
+  SymbolicExecution* cur_ex = new SymbolicExecution();
   vector<value_t> input;
 
+  const SymbolicExecution& prev_ex = *item->ex;
   const SymbolicPath& path = prev_ex.path();
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(path, &contexts);
 
-  for (size_t i = pos; (i < path.constraints().size()) && (depth > 0); i++) {
+  for (size_t i = item->bound;
+       (i < path.constraints().size()) && (item->depth > 0); i++) {
     // Solve constraints[0..i].
-    if (!SolveAtBranch(prev_ex, i, &input)) {
+    size_t branch_idx = path.constraints_idx()[i];
+    if (!SolveAtBranch(prev_ex, i, contexts[branch_idx], &input)) {
       continue;
     }
 
-    // Run on those constraints.
-    RunProgram(input, &cur_ex);
-    UpdateCoverage(cur_ex);
+    // Run on those constraints.  (A run down an already explored path
+    // is of no use.)
+    if (!RunProgram(input, cur_ex, true)) {
+      fprintf(stderr, "Path already explored.\n");
+      RecordFlip(prev_ex, branch_idx, contexts[branch_idx], false);
+      continue;
+    }
+    UpdateCoverage(*cur_ex);
 
     // Check for prediction failure.
-    size_t branch_idx = path.constraints_idx()[i];
-    if (!CheckPrediction(prev_ex, cur_ex, branch_idx)) {
+    if (!CheckFlip(prev_ex, *cur_ex, branch_idx, contexts[branch_idx])) {
       fprintf(stderr, "Prediction failed!\n");
       continue;
     }
 
-    // We successfully solved the branch, recurse.
-    depth--;
-    DFS(i+1, depth, cur_ex);
+    // We successfully solved the branch.  Push the rest of this
+    // execution's constraints, and then (to be explored first) the new
+    // execution's.
+    item->depth--;
+    worklist_.Push(item->ex, i+1, item->depth, 0);
+    worklist_.Push(cur_ex, i+1, item->depth, 0);
+    return true;
   }
+
+  delete cur_ex;
+  return false;
 }
 
 
@@ -444,7 +1099,7 @@ RandomInputSearch::~RandomInputSearch() { }
 
 void RandomInputSearch::Run() {
   vector<value_t> input;
-  RunProgram(input, &ex_);
+  InitialExecution(&ex_);
 
   while (true) {
     RandomInput(ex_.vars(), &input);
@@ -467,11 +1122,10 @@ void RandomSearch::Run() {
   SymbolicExecution next_ex;
 
   while (true) {
-    // Execution (on empty/random inputs).
+    // Execution (on the seeds, or on empty/random inputs).
     fprintf(stderr, "RESET\n");
     vector<value_t> next_input;
-    RunProgram(next_input, &ex_);
-    UpdateCoverage(ex_);
+    InitialExecution(&ex_);
 
     // Do some iterations.
     int count = 0;
@@ -480,11 +1134,12 @@ void RandomSearch::Run() {
       // SolveUncoveredBranches(0, 20, ex_);
 
       size_t idx;
-      if (SolveRandomBranch(&next_input, &idx)) {
+      branch_id_t context;
+      if (SolveRandomBranch(&next_input, &idx, &context)) {
 	RunProgram(next_input, &next_ex);
 	bool found_new_branch = UpdateCoverage(next_ex);
 	bool prediction_failed =
-	  !CheckPrediction(ex_, next_ex, ex_.path().constraints_idx()[idx]);
+	  !CheckFlip(ex_, next_ex, ex_.path().constraints_idx()[idx], context);
 
 	if (found_new_branch) {
 	  count = 0;
@@ -552,6 +1207,8 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
 
   SymbolicExecution cur_ex;
   vector<value_t> input;
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(prev_ex.path(), &contexts);
 
   int cnt = 0;
 
@@ -561,7 +1218,7 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
     if (covered_[paired_branch_[bid]])
       continue;
 
-    if (!SolveAtBranch(prev_ex, j, &input)) {
+    if (!SolveAtBranch(prev_ex, j, contexts[bid_idx], &input)) {
       if (++cnt == 1000) {
 	cnt = 0;
 	fprintf(stderr, "Failed to solve at %zu/%zu.\n",
@@ -573,7 +1230,7 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
 
     RunProgram(input, &cur_ex);
     UpdateCoverage(cur_ex);
-    if (!CheckPrediction(prev_ex, cur_ex, bid_idx)) {
+    if (!CheckFlip(prev_ex, cur_ex, bid_idx, contexts[bid_idx])) {
       fprintf(stderr, "Prediction failed.\n");
       continue;
     }
@@ -583,7 +1240,8 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
 }
 
 
-  bool RandomSearch::SolveRandomBranch(vector<value_t>* next_input, size_t* idx) {
+  bool RandomSearch::SolveRandomBranch(vector<value_t>* next_input, size_t* idx,
+                                       branch_id_t* context) {
   /*
   const SymbolicPath& p = ex_.path();
   vector<ScoredBranch> zero_branches, other_branches;
@@ -625,6 +1283,8 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
   vector<size_t> idxs(ex_.path().constraints().size());
   for (size_t i = 0; i < idxs.size(); i++)
     idxs[i] = i;
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(ex_.path(), &contexts);
 
   for (int tries = 0; tries < 1000; tries++) {
     // Pick a random index.
@@ -635,9 +1295,11 @@ void RandomSearch::SolveUncoveredBranches(size_t i, int depth,
     swap(idxs[r], idxs.back());
     idxs.pop_back();
 
-    if (SolveAtBranch(ex_, i, next_input)) {
+    if (SolveAtBranch(ex_, i, contexts[ex_.path().constraints_idx()[i]],
+                      next_input)) {
       fprintf(stderr, "Solved %zu/%zu\n", i, idxs.size());
       *idx = i;
+      *context = contexts[ex_.path().constraints_idx()[i]];
       return true;
     }
   }
@@ -661,46 +1323,56 @@ UniformRandomSearch::UniformRandomSearch(const string& program,
 UniformRandomSearch::~UniformRandomSearch() { }
 
 void UniformRandomSearch::Run() {
-  // Initial execution (on empty/random inputs).
-  RunProgram(vector<value_t>(), &prev_ex_);
-  UpdateCoverage(prev_ex_);
+  // Initial execution (on the seeds, or on empty/random inputs).
+  InitialExecution(&prev_ex_);
 
   while (true) {
     fprintf(stderr, "RESET\n");
 
-    // Uniform random path.
-    DoUniformRandomPath();
+    // Uniform random path.  (If no branch could be forced, start over
+    // from a random input.)
+    if (!DoUniformRandomPath()) {
+      RunProgram(vector<value_t>(), &prev_ex_);
+      UpdateCoverage(prev_ex_);
+    }
   }
 }
 
-void UniformRandomSearch::DoUniformRandomPath() {
+bool UniformRandomSearch::DoUniformRandomPath() {
   vector<value_t> input;
+  bool ran = false;
 
   size_t i = 0;
   size_t depth = 0;
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(prev_ex_.path(), &contexts);
   fprintf(stderr, "%zu constraints.\n", prev_ex_.path().constraints().size());
   while ((i < prev_ex_.path().constraints().size()) && (depth < max_depth_)) {
-    if (SolveAtBranch(prev_ex_, i, &input)) {
+    size_t branch_idx = prev_ex_.path().constraints_idx()[i];
+    if (SolveAtBranch(prev_ex_, i, contexts[branch_idx], &input)) {
       fprintf(stderr, "Solved constraint %zu/%zu.\n",
 	      (i+1), prev_ex_.path().constraints().size());
       depth++;
 
       // With probability 0.5, force the i-th constraint.
       if (rand() % 2 == 0) {
+	ran = true;
 	RunProgram(input, &cur_ex_);
 	UpdateCoverage(cur_ex_);
-	size_t branch_idx = prev_ex_.path().constraints_idx()[i];
-	if (!CheckPrediction(prev_ex_, cur_ex_, branch_idx)) {
+	if (!CheckFlip(prev_ex_, cur_ex_, branch_idx, contexts[branch_idx])) {
 	  fprintf(stderr, "prediction failed\n");
 	  depth--;
 	} else {
 	  cur_ex_.Swap(prev_ex_);
+	  FlipStats::CallingContexts(prev_ex_.path(), &contexts);
 	}
       }
     }
 
     i++;
   }
+
+  return ran;
 }
 
 
@@ -717,9 +1389,8 @@ void HybridSearch::Run() {
   SymbolicExecution ex;
 
   while (true) {
-    // Execution on empty/random inputs.
-    RunProgram(vector<value_t>(), &ex);
-    UpdateCoverage(ex);
+    // Execution on the seeds, or on empty/random inputs.
+    InitialExecution(&ex);
 
     // Local searches at increasingly deeper execution points.
     for (size_t pos = 0; pos < ex.path().constraints().size(); pos += step_size_) {
@@ -750,6 +1421,8 @@ bool HybridSearch::RandomStep(SymbolicExecution *ex, size_t start, size_t end) {
   for (size_t i = 0; i < idxs.size(); i++) {
     idxs[i] = start + i;
   }
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(ex->path(), &contexts);
 
   for (int tries = 0; tries < 1000; tries++) {
     // Pick a random index.
@@ -760,10 +1433,11 @@ bool HybridSearch::RandomStep(SymbolicExecution *ex, size_t start, size_t end) {
     swap(idxs[r], idxs.back());
     idxs.pop_back();
 
-    if (SolveAtBranch(*ex, i, &input)) {
+    const size_t branch_idx = ex->path().constraints_idx()[i];
+    if (SolveAtBranch(*ex, i, contexts[branch_idx], &input)) {
       RunProgram(input, &next_ex);
       UpdateCoverage(next_ex);
-      if (CheckPrediction(*ex, next_ex, ex->path().constraints_idx()[i])) {
+      if (CheckFlip(*ex, next_ex, branch_idx, contexts[branch_idx])) {
 	ex->Swap(next_ex);
 	return true;
       }
@@ -788,10 +1462,9 @@ void CfgBaselineSearch::Run() {
   SymbolicExecution ex;
 
   while (true) {
-    // Execution on empty/random inputs.
+    // Execution on the seeds, or on empty/random inputs.
     fprintf(stderr, "RESET\n");
-    RunProgram(vector<value_t>(), &ex);
-    UpdateCoverage(ex);
+    InitialExecution(&ex);
 
     while (DoSearch(5, 250, 0, ex)) {
       // As long as we keep finding new branches . . . .
@@ -832,12 +1505,17 @@ bool CfgBaselineSearch::DoSearch(int depth, int iters, int pos,
   // Solve.
   SymbolicExecution cur_ex;
   vector<value_t> input;
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(prev_ex.path(), &contexts);
   for (size_t i = 0; i < scoredBranches.size(); i++) {
     if (iters <= 0) {
       return false;
     }
 
-    if (!SolveAtBranch(prev_ex, scoredBranches[i].first, &input)) {
+    const size_t idx = scoredBranches[i].first;
+    if (!SolveAtBranch(prev_ex, idx,
+                       contexts[prev_ex.path().constraints_idx()[idx]],
+                       &input)) {
       continue;
     }
 
@@ -861,29 +1539,17 @@ bool CfgBaselineSearch::DoSearch(int depth, int iters, int pos,
 CfgHeuristicSearch::CfgHeuristicSearch
 (const string& program, int max_iterations)
   : Search(program, max_iterations),
-    cfg_(max_branch_), cfg_rev_(max_branch_), dist_(max_branch_) {
-
-  // Read in the CFG.
-  ifstream in("cfg_branches", ios::in | ios::binary);
-  assert(in);
-  size_t num_branches;
-  in.read((char*)&num_branches, sizeof(num_branches));
-  assert(num_branches == branches_.size());
-  for (size_t i = 0; i < num_branches; i++) {
-    branch_id_t src;
-    size_t len;
-    in.read((char*)&src, sizeof(src));
-    in.read((char*)&len, sizeof(len));
-    cfg_[src].resize(len);
-    in.read((char*)&cfg_[src].front(), len * sizeof(branch_id_t));
+    dist_(branches_, bundle_.cfg(), bundle_.cfg_rev()) {
+
+  if (!bundle_.has_cfg()) {
+    fprintf(stderr, "Failed to read cfg_branches.\n");
+    exit(-1);
   }
-  in.close();
 
-  // Construct the reversed CFG.
-  for (BranchIt i = branches_.begin(); i != branches_.end(); ++i) {
-    for (BranchIt j = cfg_[*i].begin(); j != cfg_[*i].end(); ++j) {
-      cfg_rev_[*j].push_back(*i);
-    }
+  { vector<unsigned*> counters;
+    GetCounters(&counters);
+    for (size_t i = 0; i < counters.size(); i++)
+      *counters[i] = 0;
   }
 }
 
@@ -895,14 +1561,19 @@ void CfgHeuristicSearch::Run() {
   set<branch_id_t> newly_covered_;
   SymbolicExecution ex;
 
+  // When resuming, keep the restored coverage for the first round.
+  bool reset = !resumed_;
+
   while (true) {
-    covered_.assign(max_branch_, false);
-    num_covered_ = 0;
+    if (reset) {
+      covered_.assign(max_branch_, false);
+      num_covered_ = 0;
+    }
+    reset = true;
 
-    // Execution on empty/random inputs.
+    // Execution on the seeds, or on empty/random inputs.
     fprintf(stderr, "RESET\n");
-    RunProgram(vector<value_t>(), &ex);
-    if (UpdateCoverage(ex)) {
+    if (InitialExecution(&ex)) {
       UpdateBranchDistances();
       PrintStats();
     }
@@ -936,33 +1607,51 @@ void CfgHeuristicSearch::PrintStats() {
   fprintf(stderr, "    (sat failures: %u/%u)  (prediction failures: %u) (recursions: %u)\n",
 	  num_solve_unsats_, num_solve_sat_attempts_,
 	  num_solve_pred_fails_, num_solve_recurses_);
+  fprintf(stderr, "Distance updates: %u full, %u incremental (%zu branches recomputed)\n",
+	  dist_.num_full_updates(), dist_.num_incremental_updates(),
+	  dist_.num_nodes_recomputed());
 }
 
 
-void CfgHeuristicSearch::UpdateBranchDistances() {
-  // We run a BFS backward, starting simultaneously at all uncovered vertices.
-  queue<branch_id_t> Q;
-  for (BranchIt i = branches_.begin(); i != branches_.end(); ++i) {
-    if (!covered_[*i]) {
-      dist_[*i] = 0;
-      Q.push(*i);
-    } else {
-      dist_[*i] = kInfiniteDistance;
-    }
-  }
+void CfgHeuristicSearch::GetCounters(vector<unsigned*>* counters) {
+  unsigned* fields[] = {
+    &num_inner_solves_, &num_inner_successes_pred_fail_,
+    &num_inner_lucky_successes_, &num_inner_zero_successes_,
+    &num_inner_nonzero_successes_, &num_inner_recursive_successes_,
+    &num_inner_unsats_, &num_inner_pred_fails_,
+    &num_top_solves_, &num_top_solve_successes_,
+    &num_solves_, &num_solve_successes_, &num_solve_sat_attempts_,
+    &num_solve_unsats_, &num_solve_recurses_, &num_solve_pred_fails_,
+    &num_solve_all_concrete_, &num_solve_no_paths_
+  };
+  counters->assign(fields, fields + sizeof(fields) / sizeof(fields[0]));
+}
 
-  while (!Q.empty()) {
-    branch_id_t i = Q.front();
-    size_t dist_i = dist_[i];
-    Q.pop();
 
-    for (BranchIt j = cfg_rev_[i].begin(); j != cfg_rev_[i].end(); ++j) {
-      if (dist_i + 1 < dist_[*j]) {
-	dist_[*j] = dist_i + 1;
-	Q.push(*j);
-      }
-    }
+void CfgHeuristicSearch::SaveState(string* s) {
+  vector<unsigned*> counters;
+  GetCounters(&counters);
+  for (size_t i = 0; i < counters.size(); i++)
+    WriteRaw(s, *counters[i]);
+}
+
+
+bool CfgHeuristicSearch::LoadState(istream& in) {
+  vector<unsigned*> counters;
+  GetCounters(&counters);
+  for (size_t i = 0; i < counters.size(); i++) {
+    if (!ReadRaw(in, counters[i]))
+      return false;
   }
+
+  // The distances depend only on the (restored) coverage.
+  UpdateBranchDistances();
+  return true;
+}
+
+
+void CfgHeuristicSearch::UpdateBranchDistances() {
+  dist_.Update(covered_);
 }
 
 
@@ -990,6 +1679,9 @@ bool CfgHeuristicSearch::DoSearch(int depth,
     scoredBranches[i].first = i + pos;
   }
 
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(prev_ex.path(), &contexts);
+
   { // Compute (and sort by) the scores.
     random_shuffle(scoredBranches.begin(), scoredBranches.end());
     map<branch_id_t,int> seen;
@@ -998,7 +1690,8 @@ bool CfgHeuristicSearch::DoSearch(int depth,
       size_t branch_idx = prev_ex.path().constraints_idx()[idx];
       branch_id_t bid = paired_branch_[prev_ex.path().branches()[branch_idx]];
 
-      scoredBranches[i].second = dist_[bid] + seen[bid];
+      scoredBranches[i].second = dist_[bid] + seen[bid]
+        + FlipPenalty(prev_ex, idx, contexts[branch_idx]);
       seen[bid] += 1;
 
       /*
@@ -1022,7 +1715,9 @@ bool CfgHeuristicSearch::DoSearch(int depth,
 
     num_inner_solves_ ++;
 
-    if (!SolveAtBranch(prev_ex, scoredBranches[i].first, &input)) {
+    size_t b_idx = prev_ex.path().constraints_idx()[scoredBranches[i].first];
+    if (!SolveAtBranch(prev_ex, scoredBranches[i].first, contexts[b_idx],
+                       &input)) {
       num_inner_unsats_ ++;
       continue;
     }
@@ -1030,11 +1725,11 @@ bool CfgHeuristicSearch::DoSearch(int depth,
     RunProgram(input, &cur_ex);
     iters--;
 
-    size_t b_idx = prev_ex.path().constraints_idx()[scoredBranches[i].first];
     branch_id_t bid = paired_branch_[prev_ex.path().branches()[b_idx]];
     set<branch_id_t> new_branches;
     bool found_new_branch = UpdateCoverage(cur_ex, &new_branches);
-    bool prediction_failed = !CheckPrediction(prev_ex, cur_ex, b_idx);
+    bool prediction_failed = !CheckFlip(prev_ex, cur_ex, b_idx, contexts[b_idx]);
+    PathIndex index(cur_ex);
 
 
     if (found_new_branch && prediction_failed) {
@@ -1054,9 +1749,9 @@ bool CfgHeuristicSearch::DoSearch(int depth,
     if (found_new_branch && !prediction_failed) {
       fprintf(stderr, "Found new branch by forcing at distance %zu (%d).\n",
 	      dist_[bid], scoredBranches[i].second);
-      size_t min_dist = MinCflDistance(b_idx, cur_ex, new_branches);
+      size_t min_dist = MinCflDistance(b_idx, index, new_branches);
       // Check if we were lucky.
-      if (FindAlongCfg(b_idx, dist_[bid], cur_ex, new_branches)) {
+      if (FindAlongCfg(b_idx, dist_[bid], index, new_branches)) {
 	assert(min_dist <= dist_[bid]);
 	// A legitimate find -- return success.
 	if (dist_[bid] == 0) {
@@ -1086,7 +1781,7 @@ bool CfgHeuristicSearch::DoSearch(int depth,
     // If we reached here, then scoredBranches[i].second is greater than 0.
     num_top_solves_ ++;
     if ((dist_[bid] > 0) &&
-        SolveAlongCfg(b_idx, scoredBranches[i].second-1, cur_ex)) {
+        SolveAlongCfg(b_idx, scoredBranches[i].second-1, cur_ex, &index)) {
       num_top_solve_successes_ ++;
       PrintStats();
       return true;
@@ -1110,9 +1805,9 @@ bool CfgHeuristicSearch::DoSearch(int depth,
 
 
 size_t CfgHeuristicSearch::MinCflDistance
-(size_t i, const SymbolicExecution& ex, const set<branch_id_t>& bs) {
+(size_t i, const PathIndex& index, const set<branch_id_t>& bs) {
 
-  const vector<branch_id_t>& p = ex.path().branches();
+  const vector<branch_id_t>& p = index.path;
 
   if (i >= p.size())
     return numeric_limits<size_t>::max();
@@ -1124,24 +1819,26 @@ size_t CfgHeuristicSearch::MinCflDistance
   size_t min_dist = numeric_limits<size_t>::max();
   size_t cur_dist = 1;
 
+  // Only the elements of the branch's own thread are walked.
   fprintf(stderr, "Found uncovered branches at distances:");
-  for (BranchIt j = p.begin()+i+1; j != p.end(); ++j) {
-    if (bs.find(*j) != bs.end()) {
+  for (size_t k = index.next[i]; k < p.size(); k = index.next[k]) {
+    const branch_id_t j = p[k];
+    if (bs.find(j) != bs.end()) {
       min_dist = min(min_dist, cur_dist);
       fprintf(stderr, " %zu", cur_dist);
     }
 
-    if (*j >= 0) {
+    if (j >= 0) {
       cur_dist++;
-    } else if (*j == kCallId) {
+    } else if (j == kCallId) {
       stack.push_back(cur_dist);
-    } else if (*j == kReturnId) {
+    } else if (j == kReturnId) {
       if (stack.size() == 0)
 	break;
       cur_dist = stack.back();
       stack.pop_back();
     } else {
-      fprintf(stderr, "\nBad branch id: %d\n", *j);
+      fprintf(stderr, "\nBad branch id: %d\n", j);
       exit(1);
     }
   }
@@ -1150,36 +1847,48 @@ size_t CfgHeuristicSearch::MinCflDistance
   return min_dist;
 }
 
+
 bool CfgHeuristicSearch::FindAlongCfg(size_t i, unsigned int dist,
-				      const SymbolicExecution& ex,
+				      const PathIndex& index,
 				      const set<branch_id_t>& bs) {
 
-  const vector<branch_id_t>& path = ex.path().branches();
+  const vector<branch_id_t>& path = index.path;
 
   if (i >= path.size())
     return false;
 
-  branch_id_t bid = path[i];
-  if (bs.find(bid) != bs.end())
-    return true;
-
-  if (dist == 0)
-    return false;
-
-  // Compute the indices of all branches on the path that immediately
-  // follow the current branch (corresponding to the i-th constraint)
-  // in the CFG. For example, consider the path:
+  // Walk breadth-first, up to the given distance, along the branches
+  // on the path that immediately follow each other in the CFG.  For
+  // example, consider the path:
   //     * ( ( ( 1 2 ) 4 ) ( 5 ( 6 7 ) ) 8 ) 9
   // where '*' is the current branch.  The branches immediately
-  // following '*' are : 1, 4, 5, 8, and 9.
-  vector<size_t> idxs;
-  { size_t pos = i + 1;
-    CollectNextBranches(path, &pos, &idxs);
-  }
+  // following '*' are : 1, 4, 5, 8, and 9.  Each branch is visited
+  // once, at its least distance, so the walk is linear in the length
+  // of the path.
+  vector<char> seen(path.size(), false);
+  vector<size_t> frontier(1, i), next, idxs;
+  seen[i] = true;
+  for (unsigned int d = 0; !frontier.empty(); d++) {
+    for (vector<size_t>::const_iterator j = frontier.begin(); j != frontier.end(); ++j) {
+      if (bs.find(path[*j]) != bs.end())
+	return true;
+    }
+    if (d == dist)
+      return false;
 
-  for (vector<size_t>::const_iterator j = idxs.begin(); j != idxs.end(); ++j) {
-    if (FindAlongCfg(*j, dist-1, ex, bs))
-      return true;
+    next.clear();
+    for (vector<size_t>::const_iterator j = frontier.begin(); j != frontier.end(); ++j) {
+      size_t pos = index.next[*j];
+      idxs.clear();
+      CollectNextBranches(index, &pos, &idxs);
+      for (vector<size_t>::const_iterator k = idxs.begin(); k != idxs.end(); ++k) {
+	if (!seen[*k]) {
+	  seen[*k] = true;
+	  next.push_back(*k);
+	}
+      }
+    }
+    frontier.swap(next);
   }
 
   return false;
@@ -1187,7 +1896,13 @@ bool CfgHeuristicSearch::FindAlongCfg(size_t i, unsigned int dist,
 
 
 bool CfgHeuristicSearch::SolveAlongCfg(size_t i, unsigned int max_dist,
-				       const SymbolicExecution& prev_ex) {
+				       const SymbolicExecution& prev_ex,
+				       PathIndex* index) {
+  // Don't repeat a search which has already failed from this branch of
+  // this execution, with at least as large a distance.
+  if (max_dist + 1ULL <= index->failed[i])
+    return false;
+
   num_solves_ ++;
 
   fprintf(stderr, "SolveAlongCfg(%zu,%u)\n", i, max_dist);
@@ -1203,8 +1918,8 @@ bool CfgHeuristicSearch::SolveAlongCfg(size_t i, unsigned int max_dist,
   // following '*' are : 1, 4, 5, 8, and 9.
   bool found_path = false;
   vector<size_t> idxs;
-  { size_t pos = i + 1;
-    CollectNextBranches(path, &pos, &idxs);
+  { size_t pos = index->next[i];
+    CollectNextBranches(*index, &pos, &idxs);
     // fprintf(stderr, "Branches following %d:", path[i]);
     for (size_t j = 0; j < idxs.size(); j++) {
       // fprintf(stderr, " %d(%u,%u,%u)", path[idxs[j]], idxs[j],
@@ -1218,6 +1933,7 @@ bool CfgHeuristicSearch::SolveAlongCfg(size_t i, unsigned int max_dist,
 
   if (!found_path) {
     num_solve_no_paths_ ++;
+    index->failed[i] = max_dist + 1ULL;
     return false;
   }
 
@@ -1238,7 +1954,7 @@ bool CfgHeuristicSearch::SolveAlongCfg(size_t i, unsigned int max_dist,
     if (dist_[path[*j]] <= max_dist) {
       // No need to force, this branch is on a shortest path.
       num_solve_recurses_ ++;
-      if (SolveAlongCfg(*j, max_dist-1, prev_ex)) {
+      if (SolveAlongCfg(*j, max_dist-1, prev_ex, index)) {
 	num_solve_successes_ ++;
 	return true;
       }
@@ -1261,78 +1977,37 @@ bool CfgHeuristicSearch::SolveAlongCfg(size_t i, unsigned int max_dist,
     if(dist_[paired_branch_[path[*j]]] <= max_dist) {
       num_solve_sat_attempts_ ++;
       // The paired branch is along a shortest path, so force.
-      if (!SolveAtBranch(prev_ex, c_idx, &input)) {
+      if (!SolveAtBranch(prev_ex, c_idx, index->context[*j], &input)) {
 	num_solve_unsats_ ++;
 	continue;
       }
       RunProgram(input, &cur_ex);
+      const bool predicted =
+        CheckFlip(prev_ex, cur_ex, *j, index->context[*j]);
       if (UpdateCoverage(cur_ex)) {
 	num_solve_successes_ ++;
 	success_ex_.Swap(cur_ex);
 	return true;
       }
-      if (!CheckPrediction(prev_ex, cur_ex, *j)) {
+      if (!predicted) {
 	num_solve_pred_fails_ ++;
 	continue;
       }
 
       // Recurse.
       num_solve_recurses_ ++;
-      if (SolveAlongCfg(*j, max_dist-1, cur_ex)) {
+      PathIndex cur_index(cur_ex);
+      if (SolveAlongCfg(*j, max_dist-1, cur_ex, &cur_index)) {
 	num_solve_successes_ ++;
 	return true;
       }
     }
   }
 
+  index->failed[i] = max(index->failed[i], max_dist + 1ULL);
   return false;
 }
 
-void CfgHeuristicSearch::SkipUntilReturn(const vector<branch_id_t> path, size_t* pos) {
-  while ((*pos < path.size()) && (path[*pos] != kReturnId)) {
-    if (path[*pos] == kCallId) {
-      (*pos)++;
-      SkipUntilReturn(path, pos);
-      if (*pos >= path.size())
-	return;
-      assert(path[*pos] == kReturnId);
-    }
-    (*pos)++;
-  }
-}
-
-void CfgHeuristicSearch::CollectNextBranches
-(const vector<branch_id_t>& path, size_t* pos, vector<size_t>* idxs) {
-  // fprintf(stderr, "Collect(%u,%u,%u)\n", path.size(), *pos, idxs->size());
-
-  // Eat an arbitrary sequence of call-returns, collecting inside each one.
-  while ((*pos < path.size()) && (path[*pos] == kCallId)) {
-    (*pos)++;
-    CollectNextBranches(path, pos, idxs);
-    SkipUntilReturn(path, pos);
-    if (*pos >= path.size())
-      return;
-    assert(path[*pos] == kReturnId);
-    (*pos)++;
-  }
-
-  // If the sequence of calls is followed by a branch, add it.
-  if ((*pos < path.size()) && (path[*pos] >= 0)) {
-    idxs->push_back(*pos);
-    (*pos)++;
-    return;
-  }
-
-  // Alternatively, if the sequence is followed by a return, collect the branches
-  // immediately following the return.
-  /*
-  if ((*pos < path.size()) && (path[*pos] == kReturnId)) {
-    (*pos)++;
-    CollectNextBranches(path, pos, idxs);
-  }
-  */
-}
-
 
 bool CfgHeuristicSearch::DoBoundedBFS(int i, int depth, const SymbolicExecution& prev_ex) {
   if (depth <= 0)
@@ -1345,19 +2020,24 @@ bool CfgHeuristicSearch::DoBoundedBFS(int i, int depth, const SymbolicExecution&
   SymbolicExecution cur_ex;
   vector<value_t> input;
   const vector<SymbolicPred*>& constraints = prev_ex.path().constraints();
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(prev_ex.path(), &contexts);
   for (size_t j = static_cast<size_t>(i); j < constraints.size(); j++) {
-    if (!SolveAtBranch(prev_ex, j, &input)) {
+    const size_t branch_idx = prev_ex.path().constraints_idx()[j];
+    if (!SolveAtBranch(prev_ex, j, contexts[branch_idx], &input)) {
       continue;
     }
 
     RunProgram(input, &cur_ex);
     iters_left_--;
+    const bool predicted =
+      CheckFlip(prev_ex, cur_ex, branch_idx, contexts[branch_idx]);
     if (UpdateCoverage(cur_ex)) {
       success_ex_.Swap(cur_ex);
       return true;
     }
 
-    if (!CheckPrediction(prev_ex, cur_ex, prev_ex.path().constraints_idx()[j])) {
+    if (!predicted) {
       fprintf(stderr, "Prediction failed!\n");
       continue;
     }
@@ -1369,4 +2049,399 @@ bool CfgHeuristicSearch::DoBoundedBFS(int i, int depth, const SymbolicExecution&
   return false;
 }
 
+////////////////////////////////////////////////////////////////////////
+//// GenerationalSearch ////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+GenerationalSearch::GenerationalSearch(const string& program, int max_iterations)
+  : Search(program, max_iterations), worklist_(Worklist::HighestScore, 0) {
+  current_.ex = NULL;
+}
+
+
+GenerationalSearch::~GenerationalSearch() {
+  delete current_.ex;
+}
+
+
+void GenerationalSearch::Run() {
+  worklist_.set_max_bytes(max_worklist_bytes_);
+
+  while (true) {
+    if (worklist_.empty()) {
+      // Execution on the seeds, or on empty/random inputs.
+      fprintf(stderr, "RESET\n");
+      SymbolicExecution* ex = new SymbolicExecution();
+      set<branch_id_t> new_branches;
+      InitialExecution(ex, &new_branches);
+      worklist_.Push(ex, 0, 0, new_branches.size());
+    }
+
+    while (worklist_.Pop(&current_)) {
+      ExpandExecution(*current_.ex, current_.bound);
+      delete current_.ex;
+      current_.ex = NULL;
+    }
+  }
+}
+
+
+void GenerationalSearch::ImportExecution(SymbolicExecution* ex) {
+  // Score imported executions as highly as possible, since they are
+  // known to reach new branches.
+  worklist_.Push(ex, 0, 0, max_branch_);
+}
+
+void GenerationalSearch::AddSeedExecution(SymbolicExecution* ex, size_t score) {
+  worklist_.Push(ex, 0, 0, score);
+}
+
+
+void GenerationalSearch::SaveState(string* s) {
+  // An execution interrupted in the middle of its expansion is saved
+  // whole -- on resume, the flips already tried are skipped.
+  worklist_.Save(s, current_.ex ? &current_ : NULL);
+}
+
+
+bool GenerationalSearch::LoadState(istream& in) {
+  return worklist_.Load(in);
+}
+
+
+void GenerationalSearch::ExpandExecution(const SymbolicExecution& ex,
+                                         size_t bound) {
+  const size_t num_constraints = ex.path().constraints().size();
+  if (bound >= num_constraints)
+    return;
+
+  fprintf(stderr, "Expanding %zu constraints (%zu-%zu).\n",
+          num_constraints - bound, bound, num_constraints);
+
+  // Solve for every child of this execution at once.  The solves are
+  // independent, so they are done in parallel.
+  const int n = static_cast<int>(num_constraints - bound);
+  const vector<size_t>& idx = ex.path().constraints_idx();
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(ex.path(), &contexts);
+  vector< vector<value_t> > inputs(n);
+  vector<char> solved(n);
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < n; i++) {
+    solved[i] = SolveAtBranch(ex, bound + i, contexts[idx[bound + i]],
+                              &inputs[i]);
+  }
+
+  // Run each child, and score it by the number of branches it newly
+  // covers.
+  for (int i = 0; i < n; i++) {
+    if (!solved[i])
+      continue;
+
+    const size_t j = bound + i;
+    SymbolicExecution* child = new SymbolicExecution();
+    if (!RunProgram(inputs[i], child, true)) {
+      fprintf(stderr, "Path already explored.\n");
+      RecordFlip(ex, idx[j], contexts[idx[j]], false);
+      delete child;
+      continue;
+    }
+    set<branch_id_t> new_branches;
+    UpdateCoverage(*child, &new_branches);
+
+    if (CheckFlip(ex, *child, idx[j], contexts[idx[j]])) {
+      // As in SAGE, a child is only expanded past the constraint that
+      // was negated to produce it.
+      worklist_.Push(child, j + 1, 0, new_branches.size());
+    } else if (!new_branches.empty()) {
+      fprintf(stderr, "Prediction failed (but got lucky).\n");
+      worklist_.Push(child, 0, 0, new_branches.size());
+    } else {
+      fprintf(stderr, "Prediction failed.\n");
+      delete child;
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//// DirectedSearch ////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+DirectedSearch::DirectedSearch(const string& program, int max_iterations,
+                               const vector<branch_id_t>& targets)
+  : Search(program, max_iterations), num_reached_(0),
+    done_(max_branch_, true),
+    dist_(branches_, bundle_.cfg(), bundle_.cfg_rev()),
+    worklist_(Worklist::HighestScore, 0) {
+  current_.ex = NULL;
+
+  if (!bundle_.has_cfg()) {
+    fprintf(stderr, "Failed to read cfg_branches.\n");
+    exit(-1);
+  }
+
+  for (BranchIt i = targets.begin(); i != targets.end(); ++i) {
+    if ((*i <= 0) || (*i >= max_branch_)
+        || !binary_search(branches_.begin(), branches_.end(), *i)) {
+      fprintf(stderr, "Ignoring target %d, which is not a branch.\n", *i);
+      continue;
+    }
+    if (find(targets_.begin(), targets_.end(), *i) == targets_.end())
+      targets_.push_back(*i);
+  }
+  if (targets_.empty()) {
+    fprintf(stderr, "No target branches.\n");
+    exit(-1);
+  }
+
+  reach_time_.resize(targets_.size(), -1);
+  reach_iter_.resize(targets_.size(), 0);
+  for (BranchIt i = targets_.begin(); i != targets_.end(); ++i)
+    done_[*i] = false;
+  dist_.Recompute(done_);
+}
+
+
+DirectedSearch::~DirectedSearch() {
+  delete current_.ex;
+}
+
+
+void DirectedSearch::Run() {
+  worklist_.set_max_bytes(max_worklist_bytes_);
+  UpdateTargets();
+
+  while (true) {
+    if (worklist_.empty()) {
+      // Execution on the seeds, or on empty/random inputs.
+      fprintf(stderr, "RESET\n");
+      SymbolicExecution* ex = new SymbolicExecution();
+      InitialExecution(ex);
+      UpdateTargets();
+      PushExecution(ex, 0);
+    }
+
+    while (worklist_.Pop(&current_)) {
+      ExpandExecution(*current_.ex, current_.bound);
+      delete current_.ex;
+      current_.ex = NULL;
+    }
+  }
+}
+
+
+void DirectedSearch::ImportExecution(SymbolicExecution* ex) {
+  UpdateTargets();
+  PushExecution(ex, 0);
+}
+
+
+void DirectedSearch::AddSeedExecution(SymbolicExecution* ex, size_t score) {
+  // Seeds are ordered by their closest flip, not by their new coverage.
+  PushExecution(ex, 0);
+}
+
+
+void DirectedSearch::UpdateTargets() {
+  bool changed = false;
+  for (size_t i = 0; i < targets_.size(); i++) {
+    if ((reach_time_[i] < 0) && total_covered_[targets_[i]]) {
+      reach_time_[i] = time(NULL) - start_time_;
+      reach_iter_[i] = num_iters();
+      fprintf(stderr, "Reached target %d after %d iterations (%lds).\n",
+              targets_[i], reach_iter_[i], reach_time_[i]);
+    }
+    if ((reach_time_[i] >= 0) && !done_[targets_[i]]) {
+      done_[targets_[i]] = true;
+      num_reached_++;
+      changed = true;
+    }
+  }
+
+  if (num_reached_ == targets_.size()) {
+    Finish("all targets reached");
+  }
+  if (changed) {
+    dist_.Update(done_);
+  }
+}
+
+
+void DirectedSearch::DirectedFlips(const SymbolicExecution& ex, size_t bound,
+                                   vector< pair<size_t,size_t> >* flips) const {
+  const SymbolicPath& path = ex.path();
+  const vector<branch_id_t>& branches = path.branches();
+  const vector<size_t>& idx = path.constraints_idx();
+  flips->clear();
+  if (bound >= idx.size())
+    return;
+
+  // The branch CFG has call edges but no return edges, so dist_ alone
+  // cannot see a target in a caller from inside a callee.  So, walking
+  // the path, track for each open call the distance to a target past
+  // its matching return: one more than the nearest distance from the
+  // branches which follow the return (in either direction), or from
+  // the return of the enclosing call.  A flip inside a call is counted
+  // as leaving the call directly.  (The calls of each thread are
+  // tracked separately.)
+  PathIndex index(ex);
+  vector< vector<size_t> > exit_dists(1);  // Per open call, per thread.
+  vector<size_t> idxs;
+  size_t j = 0;
+  for (size_t k = 0; (k < branches.size()) && (j < idx.size()); k++) {
+    if (index.thread[k] >= exit_dists.size())
+      exit_dists.resize(index.thread[k] + 1);
+    vector<size_t>& exit_dist = exit_dists[index.thread[k]];
+    if (branches[k] == kCallId) {
+      size_t d = exit_dist.empty() ? kInfiniteDistance : exit_dist.back();
+      size_t pos = index.match[k];
+      idxs.clear();
+      if (pos < branches.size()) {
+        pos = index.next[pos];
+        CollectNextBranches(index, &pos, &idxs);
+      }
+      for (vector<size_t>::const_iterator i = idxs.begin(); i != idxs.end(); ++i) {
+        d = min(d, min(dist_[branches[*i]], dist_[paired_branch_[branches[*i]]]));
+      }
+      exit_dist.push_back(d < kInfiniteDistance ? d + 1 : kInfiniteDistance);
+    } else if (branches[k] == kReturnId) {
+      if (!exit_dist.empty())
+        exit_dist.pop_back();
+    } else if (idx[j] == k) {
+      if (j >= bound) {
+        size_t d = dist_[paired_branch_[branches[k]]];
+        if (!exit_dist.empty())
+          d = min(d, exit_dist.back());
+        if (d < kInfiniteDistance)
+          flips->push_back(make_pair(d, j));
+      }
+      j++;
+    }
+  }
+  sort(flips->begin(), flips->end());
+}
+
+
+void DirectedSearch::PushExecution(SymbolicExecution* ex, size_t bound) {
+  vector< pair<size_t,size_t> > flips;
+  DirectedFlips(*ex, bound, &flips);
+  if (flips.empty()) {
+    delete ex;
+    return;
+  }
+  worklist_.Push(ex, bound, 0, kInfiniteDistance - flips.front().first);
+}
+
+
+void DirectedSearch::ExpandExecution(const SymbolicExecution& ex,
+                                     size_t bound) {
+  vector< pair<size_t,size_t> > flips;
+  DirectedFlips(ex, bound, &flips);
+  if (flips.empty())
+    return;
+
+  fprintf(stderr, "Expanding %zu flips (closest at distance %zu).\n",
+          flips.size(), flips.front().first);
+
+  // Solve for the children in parallel (the closest are started first),
+  // and then run them, closest first.
+  const SymbolicPath& path = ex.path();
+  const int n = static_cast<int>(flips.size());
+  vector<branch_id_t> contexts;
+  FlipStats::CallingContexts(path, &contexts);
+  vector< vector<value_t> > inputs(n);
+  vector<char> solved(n);
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < n; i++) {
+    const size_t branch_idx = path.constraints_idx()[flips[i].second];
+    solved[i] = SolveAtBranch(ex, flips[i].second, contexts[branch_idx],
+                              &inputs[i]);
+  }
+
+  size_t num_reached = num_reached_;
+  vector<char> live(path.constraints().size(), true);
+  for (int i = 0; i < n; i++) {
+    if (!solved[i])
+      continue;
+
+    // Skip flips which, since a target was reached, can no longer lead
+    // to an unreached target.
+    if (num_reached_ != num_reached) {
+      num_reached = num_reached_;
+      vector< pair<size_t,size_t> > remaining;
+      DirectedFlips(ex, bound, &remaining);
+      live.assign(live.size(), false);
+      for (size_t k = 0; k < remaining.size(); k++)
+        live[remaining[k].second] = true;
+    }
+    const size_t j = flips[i].second;
+    if (!live[j])
+      continue;
+
+    const size_t branch_idx = path.constraints_idx()[j];
+    SymbolicExecution* child = new SymbolicExecution();
+    if (!RunProgram(inputs[i], child, true)) {
+      fprintf(stderr, "Path already explored.\n");
+      RecordFlip(ex, branch_idx, contexts[branch_idx], false);
+      delete child;
+      continue;
+    }
+    set<branch_id_t> new_branches;
+    UpdateCoverage(*child, &new_branches);
+    UpdateTargets();
+
+    if (CheckFlip(ex, *child, branch_idx, contexts[branch_idx])) {
+      PushExecution(child, j + 1);
+    } else if (!new_branches.empty()) {
+      fprintf(stderr, "Prediction failed (but got lucky).\n");
+      PushExecution(child, 0);
+    } else {
+      fprintf(stderr, "Prediction failed.\n");
+      delete child;
+    }
+  }
+}
+
+
+void DirectedSearch::PrintStats() {
+  fprintf(stderr, "Reached %zu of %zu targets.\n",
+          num_reached_, targets_.size());
+  for (size_t i = 0; i < targets_.size(); i++) {
+    if (reach_time_[i] >= 0) {
+      fprintf(stderr, "  Target %d: reached after %d iterations (%lds).\n",
+              targets_[i], reach_iter_[i], reach_time_[i]);
+    } else {
+      fprintf(stderr, "  Target %d: not reached.\n", targets_[i]);
+    }
+  }
+}
+
+
+void DirectedSearch::SaveState(string* s) {
+  WriteRaw(s, static_cast<unsigned long long>(targets_.size()));
+  for (size_t i = 0; i < targets_.size(); i++) {
+    WriteRaw(s, targets_[i]);
+    WriteRaw(s, static_cast<long long>(reach_time_[i]));
+    WriteRaw(s, reach_iter_[i]);
+  }
+  worklist_.Save(s, current_.ex ? &current_ : NULL);
+}
+
+
+bool DirectedSearch::LoadState(istream& in) {
+  unsigned long long num_targets;
+  if (!ReadRaw(in, &num_targets) || (num_targets != targets_.size()))
+    return false;
+  for (size_t i = 0; i < targets_.size(); i++) {
+    branch_id_t target;
+    long long reach_time;
+    if (!ReadRaw(in, &target) || (target != targets_[i])
+        || !ReadRaw(in, &reach_time) || !ReadRaw(in, &reach_iter_[i]))
+      return false;
+    reach_time_[i] = reach_time;
+  }
+  return worklist_.Load(in);
+}
+
 }  // namespace crest
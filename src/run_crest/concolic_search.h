@@ -12,9 +12,11 @@
 #define RUN_CREST_CONCOLIC_SEARCH_H__
 
 #include <map>
+#include <utility>
 #include <vector>
 #include <ext/hash_map>
 #include <ext/hash_set>
+#include <signal.h>
 #include <time.h>
 
 /*
@@ -25,8 +27,14 @@
 
 #include "base/basic_types.h"
 #include "base/symbolic_execution.h"
+#include "run_crest/branch_distances.h"
+#include "run_crest/execution_cache.h"
+#include "run_crest/flip_stats.h"
+#include "run_crest/shared_campaign.h"
+#include "run_crest/worklist.h"
 
 using std::map;
+using std::pair;
 using std::vector;
 using __gnu_cxx::hash_map;
 using __gnu_cxx::hash_set;
@@ -40,10 +48,60 @@ class Search {
 
   virtual void Run() = 0;
 
+  // Write input files as text instead of binary (for debugging).
+  void set_text_input(bool text_input) { text_input_ = text_input; }
+
+  // Limit on the (estimated) memory held by pending executions in a
+  // strategy's worklist.
+  void set_max_worklist_bytes(size_t bytes) { max_worklist_bytes_ = bytes; }
+
+  // Limit on the memory held by cached executions of already-run
+  // inputs.  (Zero disables the cache.)
+  void set_max_cache_bytes(size_t bytes) { cache_.set_max_bytes(bytes); }
+
+  // Stop the search after the given number of seconds, or after the
+  // given number of seconds without any new coverage.  (Zero means no
+  // limit.)
+  void set_time_budget(int seconds) { time_budget_ = seconds; }
+  void set_plateau_time(int seconds) { plateau_time_ = seconds; }
+
+  // Asks the search to stop cleanly before its next run of the program.
+  // Safe to call from a signal handler.
+  static void RequestStop() { stop_requested_ = 1; }
+  static bool stop_requested() { return stop_requested_; }
+
+  // Flushes coverage and statistics, and exits.
+  void Finish(const char* reason);
+
+  // Save a checkpoint of the search state every given number of
+  // seconds (and when the search finishes).  Zero disables checkpoints.
+  void set_checkpoint_interval(int seconds) { checkpoint_interval_ = seconds; }
+
+  // Restores the search state from a checkpoint written by an earlier
+  // run on the same program.  Must be called before Run.
+  bool Resume(const string& file);
+
+  // Makes this search a worker in a multi-process campaign: coverage is
+  // shared with the other workers, and the inputs with which they find
+  // new coverage are imported into this search.
+  void set_shared_campaign(SharedCampaign* shared) { shared_ = shared; }
+
+  // Start the search from the inputs in the given directory: files
+  // named "input" or "input.N" (e.g. from an earlier search), and any
+  // other binary input files.  The seeds are replayed in parallel.
+  void set_seeds(const string& dir) { seed_dir_ = dir; }
+
+  branch_id_t max_branch() const { return max_branch_; }
+  bool has_cfg() const { return bundle_.has_cfg(); }
+  int num_iters() const { return num_iters_; }
+
  protected:
-  vector<branch_id_t> branches_;
-  vector<branch_id_t> paired_branch_;
-  vector<function_id_t> branch_function_;
+  // The program's branches, the pairing and functions of the branches,
+  // and its branch CFG, mapped from the program bundle.
+  ProgramBundle bundle_;
+  ConstArray<branch_id_t> branches_;
+  ConstArray<branch_id_t> paired_branch_;
+  ConstArray<function_id_t> branch_function_;
   vector<bool> covered_;
   vector<bool> total_covered_;
   branch_id_t max_branch_;
@@ -51,34 +109,164 @@ class Search {
   unsigned int total_num_covered_;
 
   vector<bool> reached_;
-  vector<unsigned int> branch_count_;
+  ConstArray<unsigned int> branch_count_;
   function_id_t max_function_;
   unsigned int reachable_functions_;
   unsigned int reachable_branches_;
 
   time_t start_time_;
 
+  size_t max_worklist_bytes_;
+
   typedef vector<branch_id_t>::const_iterator BranchIt;
+  typedef ConstArray<branch_id_t>::const_iterator BranchTableIt;
 
+  // Solves for an input which flips the branch_idx-th constraint of the
+  // execution.  The context is the calling context (see FlipStats) of
+  // the constraint's branch.
   bool SolveAtBranch(const SymbolicExecution& ex,
-		     size_t branch_idx,
+		     size_t branch_idx, branch_id_t context,
 		     vector<value_t>* input);
 
   bool CheckPrediction(const SymbolicExecution& old_ex,
 		       const SymbolicExecution& new_ex,
 		       size_t branch_idx);
 
-  void RunProgram(const vector<value_t>& inputs, SymbolicExecution* ex);
+  // As CheckPrediction, for the run of a flip, also recording the
+  // outcome of the flip (in the given calling context) in the flip
+  // stats.
+  bool CheckFlip(const SymbolicExecution& old_ex,
+                 const SymbolicExecution& new_ex,
+                 size_t branch_idx, branch_id_t context);
+
+  // Records the outcome of a flip of the branch_idx-th branch of the
+  // execution, in the given calling context, in the flip stats.  (For
+  // a run which is not parsed, such as one down an explored path.)
+  void RecordFlip(const SymbolicExecution& ex, size_t branch_idx,
+                  branch_id_t context, bool success);
+
+  // Runs the program on the inputs, returning true.  If skip_known_path
+  // is set and the run followed the same path as an earlier run, the
+  // execution is not even parsed -- ex is left unchanged, and false is
+  // returned.
+  bool RunProgram(const vector<value_t>& inputs, SymbolicExecution* ex,
+                  bool skip_known_path = false);
   bool UpdateCoverage(const SymbolicExecution& ex);
   bool UpdateCoverage(const SymbolicExecution& ex,
 		      set<branch_id_t>* new_branches);
 
   void RandomInput(const map<var_t,type_t>& vars, vector<value_t>* input);
 
+  // Flips already explored by earlier runs, or already attempted, are
+  // recorded in a set of path prefixes shared by all strategies.
+  // SolveAtBranch skips these flips.
+  void RecordExploredPrefixes(const SymbolicExecution& ex);
+
+  // A penalty for flipping the branch_idx-th constraint of an
+  // execution, for strategies which order their flips: roughly the
+  // number of times the same flip has recently failed.  (SolveAtBranch
+  // skips flips which have failed repeatedly.)
+  unsigned FlipPenalty(const SymbolicExecution& ex, size_t branch_idx,
+                       branch_id_t context);
+
+  // An index of an execution's path, built once per execution for the
+  // walks along the CFG: the matching return of every call (so a walk
+  // jumps over a call rather than rescanning it), the calling context
+  // of every branch, and for each branch, the largest distance at which
+  // CfgHeuristicSearch::SolveAlongCfg has already failed from it (plus
+  // one, or zero if none).
+  //
+  // The branches, calls and returns of a multi-threaded program are
+  // interleaved on the path, so the path is split by the recorded
+  // thread switches: calls are matched, and walks step, within the
+  // thread of each element.
+  struct PathIndex {
+    explicit PathIndex(const SymbolicExecution& ex);
+
+    const vector<branch_id_t>& path;
+    vector<unsigned int> thread;
+    vector<size_t> next;   // Next element of the thread, or path.size().
+    vector<size_t> match;  // For each call, or path.size() if unmatched.
+    vector<branch_id_t> context;
+    vector<unsigned long long> failed;
+  };
+
+  // Adds to idxs the indices of the branches on the path which
+  // immediately follow position pos (in its thread) in the CFG -- the
+  // branches at the start of any calls at pos, and the branch after
+  // them -- advancing pos past them.
+  static void CollectNextBranches(const PathIndex& index,
+                                  size_t* pos, vector<size_t>* idxs);
+
+  // Runs the first execution of a search (and records its coverage,
+  // returning true if it found any new branches).  If seeds were given,
+  // then the first time this is called, they are all replayed: the most
+  // promising execution is returned, and the others are passed to
+  // AddSeedExecution.  Otherwise, the program is run on an empty input.
+  bool InitialExecution(SymbolicExecution* ex,
+                        set<branch_id_t>* new_branches = NULL);
+
+  // Set if the search state was restored from a checkpoint.
+  bool resumed_;
+
+  // Takes an execution of an input imported from another worker (after
+  // it has been run and its coverage recorded).  By default, the
+  // execution is simply discarded.
+  virtual void ImportExecution(SymbolicExecution* ex) { delete ex; }
+
+  // Takes the execution of a seed other than the most promising one,
+  // scored by the number of branches it newly covered.  By default,
+  // the execution is imported as above.
+  virtual void AddSeedExecution(SymbolicExecution* ex, size_t score) {
+    ImportExecution(ex);
+  }
+
+  // Writes or reads any strategy-specific state for a checkpoint.
+  virtual void SaveState(string* s) { }
+  virtual bool LoadState(istream& in) { return true; }
+
+  // Prints any strategy-specific statistics.  Called, among other
+  // times, when the search finishes.
+  virtual void PrintStats() { }
+
  private:
   const string program_;
   const int max_iters_; 
   int num_iters_;
+  bool text_input_;
+
+  int time_budget_;
+  int plateau_time_;
+  time_t budget_start_time_;
+  time_t last_new_coverage_time_;
+
+  int checkpoint_interval_;
+  time_t last_checkpoint_time_;
+
+  static volatile sig_atomic_t stop_requested_;
+
+  struct PathHashHasher {
+    size_t operator()(path_hash_t h) const { return static_cast<size_t>(h); }
+  };
+  enum PrefixState { kPrefixUnsat = 0, kPrefixSat = 1, kPrefixExplored = 2 };
+  hash_map<path_hash_t, char, PathHashHasher> prefixes_;
+  unsigned int num_prefix_solves_saved_;
+  unsigned int num_prefix_runs_saved_;
+
+  // The hashes of the paths of all runs.
+  hash_set<path_hash_t, PathHashHasher> known_paths_;
+  unsigned int num_known_path_runs_;
+
+  string seed_dir_;
+  bool seeds_replayed_;
+
+  ExecutionCache cache_;
+
+  FlipStats flip_stats_;
+  unsigned int num_flips_skipped_;
+
+  SharedCampaign* shared_;
+  bool importing_;
 
   /*
   struct sockaddr_un sock_;
@@ -88,6 +276,21 @@ class Search {
   void WriteInputToFileOrDie(const string& file, const vector<value_t>& input);
   void WriteCoverageToFileOrDie(const string& file);
   void LaunchProgram(const vector<value_t>& inputs);
+
+  // Returns why the search should stop, or NULL if it should not.
+  const char* StopReason() const;
+
+  void SaveCheckpoint(const string& file);
+
+  // Runs any inputs published by other workers, and adopts their
+  // coverage.
+  void ImportSharedInputs();
+
+  // Runs the program on each input, several at once (each in its own
+  // directory "replay.K"), appending the executions.  Inputs on which
+  // the program fails to write an execution are skipped.
+  void ReplayInputs(const vector< vector<value_t> >& inputs,
+                    vector<SymbolicExecution*>* exs);
 };
 
 
@@ -100,10 +303,19 @@ class BoundedDepthFirstSearch : public Search {
 
   virtual void Run();
 
+ protected:
+  virtual void ImportExecution(SymbolicExecution* ex);
+  virtual void SaveState(string* s);
+  virtual bool LoadState(istream& in);
+
  private:
   int max_depth_;
+  Worklist worklist_;
+  WorkItem current_;  // The item being explored, if any.
 
-  void DFS(size_t pos, int depth, SymbolicExecution& prev_ex);
+  // Explores the next child of the execution in item (returning false
+  // if there is none), pushing it and item back onto the worklist.
+  bool DFS(WorkItem* item);
 };
 
 
@@ -147,7 +359,8 @@ class RandomSearch : public Search {
   void SolveUncoveredBranches(size_t i, int depth,
                               const SymbolicExecution& prev_ex);
 
-  bool SolveRandomBranch(vector<value_t>* next_input, size_t* idx);
+  bool SolveRandomBranch(vector<value_t>* next_input, size_t* idx,
+                         branch_id_t* context);
 };
 
 
@@ -164,7 +377,7 @@ class UniformRandomSearch : public Search {
 
   size_t max_depth_;
 
-  void DoUniformRandomPath();
+  bool DoUniformRandomPath();
 };
 
 
@@ -224,12 +437,9 @@ class CfgHeuristicSearch : public Search {
   virtual void Run();
 
  private:
-  typedef vector<branch_id_t> nbhr_list_t;
-  vector<nbhr_list_t> cfg_;
-  vector<nbhr_list_t> cfg_rev_;
-  vector<size_t> dist_;
+  BranchDistances dist_;
 
-  static const size_t kInfiniteDistance = 10000;
+  static const size_t kInfiniteDistance = BranchDistances::kInfiniteDistance;
 
   int iters_left_;
 
@@ -257,27 +467,109 @@ class CfgHeuristicSearch : public Search {
   unsigned num_solve_all_concrete_;
   unsigned num_solve_no_paths_;
 
+  void GetCounters(vector<unsigned*>* counters);
   void UpdateBranchDistances();
-  void PrintStats();
+  virtual void PrintStats();
+  virtual void SaveState(string* s);
+  virtual bool LoadState(istream& in);
   bool DoSearch(int depth, int iters, int pos, int maxDist, const SymbolicExecution& prev_ex);
   bool DoBoundedBFS(int i, int depth, const SymbolicExecution& prev_ex);
-  void SkipUntilReturn(const vector<branch_id_t> path, size_t* pos);
 
   bool FindAlongCfg(size_t i, unsigned int dist,
-		    const SymbolicExecution& ex,
+		    const PathIndex& index,
 		    const set<branch_id_t>& bs);
 
   bool SolveAlongCfg(size_t i, unsigned int max_dist,
-		     const SymbolicExecution& prev_ex);
+		     const SymbolicExecution& prev_ex, PathIndex* index);
 
-  void CollectNextBranches(const vector<branch_id_t>& path,
-			   size_t* pos, vector<size_t>* idxs);
 
   size_t MinCflDistance(size_t i,
-			const SymbolicExecution& ex,
+			const PathIndex& index,
 			const set<branch_id_t>& bs);
 };
 
+
+// A generational search, as in SAGE: each execution taken from the
+// worklist is expanded by negating, at once, every constraint past the
+// execution's bound.  The resulting children are run, scored by the
+// number of branches they newly cover, and added to the worklist, which
+// is ordered by score.
+class GenerationalSearch : public Search {
+ public:
+  GenerationalSearch(const string& program, int max_iterations);
+  virtual ~GenerationalSearch();
+
+  virtual void Run();
+
+ protected:
+  virtual void ImportExecution(SymbolicExecution* ex);
+  virtual void AddSeedExecution(SymbolicExecution* ex, size_t score);
+  virtual void SaveState(string* s);
+  virtual bool LoadState(istream& in);
+
+ private:
+  Worklist worklist_;
+  WorkItem current_;  // The execution being expanded, if any.
+
+  void ExpandExecution(const SymbolicExecution& ex, size_t bound);
+};
+
+
+// A search directed toward the given target branches.  Each flip is
+// scored by the distance, along the (interprocedural) branch CFG, from
+// the branch it would take to the nearest target not yet reached; flips
+// which cannot lead to a target are never tried.  Executions are taken
+// from the worklist in order of their closest flip, and their flips are
+// tried closest first.  The search finishes once every target has been
+// reached, reporting the time taken to reach each one.
+class DirectedSearch : public Search {
+ public:
+  DirectedSearch(const string& program, int max_iterations,
+                 const vector<branch_id_t>& targets);
+  virtual ~DirectedSearch();
+
+  virtual void Run();
+
+ protected:
+  virtual void ImportExecution(SymbolicExecution* ex);
+  virtual void AddSeedExecution(SymbolicExecution* ex, size_t score);
+  virtual void PrintStats();
+  virtual void SaveState(string* s);
+  virtual bool LoadState(istream& in);
+
+ private:
+  static const size_t kInfiniteDistance = BranchDistances::kInfiniteDistance;
+
+  vector<branch_id_t> targets_;
+  vector<long> reach_time_;  // For each target, -1 until it is reached.
+  vector<int> reach_iter_;
+  size_t num_reached_;
+
+  // Every branch but the unreached targets counts as "covered", so the
+  // distances are to the nearest unreached target.
+  vector<bool> done_;
+  BranchDistances dist_;
+
+  Worklist worklist_;
+  WorkItem current_;  // The execution being expanded, if any.
+
+  // Records newly reached targets (finishing the search once all are
+  // reached), and updates the distances.
+  void UpdateTargets();
+
+  // The flips of the execution past the bound which can lead to an
+  // unreached target, closest first, as (distance, constraint index).
+  // A flip inside a call can also lead to a target past the call's
+  // return on the execution's path.
+  void DirectedFlips(const SymbolicExecution& ex, size_t bound,
+                     vector< pair<size_t,size_t> >* flips) const;
+
+  // Pushes the execution, scored by its closest flip, if it has any.
+  void PushExecution(SymbolicExecution* ex, size_t bound);
+
+  void ExpandExecution(const SymbolicExecution& ex, size_t bound);
+};
+
 }  // namespace crest
 
 #endif  // RUN_CREST_CONCOLIC_SEARCH_H__
@@ -0,0 +1,89 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include "run_crest/execution_cache.h"
+
+namespace crest {
+
+ExecutionCache::ExecutionCache(size_t max_bytes)
+  : first_seq_(0), max_bytes_(max_bytes), bytes_(0), num_hits_(0) { }
+
+
+unsigned long long ExecutionCache::Hash(const vector<value_t>& input) {
+  // FNV-1a, over the bytes of the values.
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>
+    (input.empty() ? NULL : &input.front());
+  for (size_t i = 0; i < input.size() * sizeof(value_t); i++) {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+
+size_t ExecutionCache::EntryBytes(const Entry& e) {
+  return sizeof(Entry) + e.input.capacity() * sizeof(value_t)
+    + e.execution.capacity();
+}
+
+
+const string* ExecutionCache::Lookup(const vector<value_t>& input) {
+  hash_map<unsigned long long, unsigned long long, HashHasher>::const_iterator
+    it = index_.find(Hash(input));
+  if (it == index_.end())
+    return NULL;
+
+  const Entry& e = entries_[it->second - first_seq_];
+  if (e.input != input)
+    return NULL;  // A hash collision.
+
+  num_hits_++;
+  return &e.execution;
+}
+
+
+void ExecutionCache::Insert(const vector<value_t>& input,
+                            const string& execution) {
+  if (max_bytes_ == 0)
+    return;
+
+  const unsigned long long h = Hash(input);
+  if (index_.find(h) != index_.end())
+    return;  // Already cached (or a collision, which is not worth caching).
+
+  entries_.push_back(Entry());
+  Entry& e = entries_.back();
+  e.hash = h;
+  e.input = input;
+  e.execution = execution;
+  bytes_ += EntryBytes(e);
+  index_[h] = first_seq_ + entries_.size() - 1;
+
+  Evict();
+}
+
+
+void ExecutionCache::set_max_bytes(size_t max_bytes) {
+  max_bytes_ = max_bytes;
+  Evict();
+}
+
+
+void ExecutionCache::Evict() {
+  while ((bytes_ > max_bytes_) && !entries_.empty()) {
+    const Entry& e = entries_.front();
+    bytes_ -= EntryBytes(e);
+    index_.erase(e.hash);
+    entries_.pop_front();
+    first_seq_++;
+  }
+}
+
+}  // namespace crest
@@ -0,0 +1,80 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_EXECUTION_CACHE_H__
+#define RUN_CREST_EXECUTION_CACHE_H__
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <ext/hash_map>
+
+#include "base/basic_types.h"
+
+using std::deque;
+using std::string;
+using std::vector;
+using __gnu_cxx::hash_map;
+
+namespace crest {
+
+// A cache of the serialized executions of the program on recently run
+// inputs, so that an input which has already been run (e.g. a solution
+// merged back into an identical earlier input) need not be run again.
+//
+// The oldest entries are evicted first once the entries hold more than
+// a given number of bytes.
+class ExecutionCache {
+ public:
+  explicit ExecutionCache(size_t max_bytes);
+
+  // Returns the execution recorded for the input, if any.
+  const string* Lookup(const vector<value_t>& input);
+
+  void Insert(const vector<value_t>& input, const string& execution);
+
+  void set_max_bytes(size_t max_bytes);
+
+  size_t size() const { return entries_.size(); }
+  size_t bytes() const { return bytes_; }
+  unsigned num_hits() const { return num_hits_; }
+
+ private:
+  struct Entry {
+    unsigned long long hash;
+    vector<value_t> input;
+    string execution;
+  };
+
+  struct HashHasher {
+    size_t operator()(unsigned long long h) const {
+      return static_cast<size_t>(h);
+    }
+  };
+
+  // Entries in the order they were inserted, indexed by the hash of
+  // their inputs.  (Index values are sequence numbers, so that they
+  // survive evictions from the front of the deque.)
+  deque<Entry> entries_;
+  unsigned long long first_seq_;
+  hash_map<unsigned long long, unsigned long long, HashHasher> index_;
+
+  size_t max_bytes_;
+  size_t bytes_;
+  unsigned num_hits_;
+
+  static unsigned long long Hash(const vector<value_t>& input);
+  static size_t EntryBytes(const Entry& e);
+  void Evict();
+};
+
+}  // namespace crest
+
+#endif  // RUN_CREST_EXECUTION_CACHE_H__
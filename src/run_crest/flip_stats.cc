@@ -0,0 +1,163 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <math.h>
+#include <utility>
+
+#include "run_crest/checkpoint.h"
+#include "run_crest/flip_stats.h"
+
+using std::make_pair;
+using std::pair;
+
+namespace crest {
+
+namespace {
+
+// A flip is skipped after about three recent failures in one calling
+// context, or about twelve across all contexts.  (The thresholds are a
+// little lower, as the scores have decayed slightly.)
+const double kContextSkipThreshold = 2.5;
+const double kBranchSkipThreshold = 11.5;
+
+// Limit on the number of entries; failures of flips without an entry
+// are not recorded once it is reached.
+const size_t kMaxEntries = 1 << 20;
+
+}  // namespace
+
+
+FlipStats::FlipStats() : tick_(0), num_failures_(0) { }
+
+
+void FlipStats::CallingContexts(const SymbolicPath& path,
+                                vector<branch_id_t>* contexts) {
+  typedef vector< pair<branch_id_t,branch_id_t> > Frames;
+  const vector<branch_id_t>& branches = path.branches();
+  const vector<size_t>& switches_idx = path.thread_switches_idx();
+  const vector<unsigned int>& switches = path.thread_switches();
+
+  // For each thread, for each open call, the context of its branches,
+  // and the last branch taken so far in the called function.
+  vector<Frames> frames(1, Frames(1, make_pair(0, 0)));
+  unsigned int tid = 0;
+  contexts->resize(branches.size());
+  for (size_t i = 0, s = 0; i < branches.size(); i++) {
+    while ((s < switches.size()) && (switches_idx[s] <= i)) {
+      tid = switches[s++];
+      if (tid >= frames.size())
+        frames.resize(tid + 1, Frames(1, make_pair(0, 0)));
+    }
+    Frames& f = frames[tid];
+    if (branches[i] == kCallId) {
+      f.push_back(make_pair(f.back().second, 0));
+    } else if ((branches[i] == kReturnId) && (f.size() > 1)) {
+      f.pop_back();
+    }
+    (*contexts)[i] = f.back().first;
+    if (branches[i] >= 0)
+      f.back().second = branches[i];
+  }
+}
+
+
+unsigned long long FlipStats::Key(branch_id_t target, branch_id_t context) {
+  return (static_cast<unsigned long long>(static_cast<unsigned>(target)) << 32)
+    | static_cast<unsigned>(context);
+}
+
+
+unsigned long long FlipStats::BranchKey(branch_id_t target) {
+  return Key(target, kCallId);
+}
+
+
+double FlipStats::Score(unsigned long long key) const {
+  StatsMap::const_iterator it = stats_.find(key);
+  if (it == stats_.end())
+    return 0.0;
+  const Entry& e = it->second;
+  return e.score * pow(0.5, double(tick_ - e.tick) / kHalfLife);
+}
+
+
+void FlipStats::Add(unsigned long long key, double delta, double scale) {
+  StatsMap::iterator it = stats_.find(key);
+  if (it == stats_.end()) {
+    if ((delta <= 0.0) || (stats_.size() >= kMaxEntries))
+      return;
+    it = stats_.insert(make_pair(key, Entry())).first;
+    it->second.tick = tick_;
+  }
+  Entry& e = it->second;
+  e.score = e.score * pow(0.5, double(tick_ - e.tick) / kHalfLife) * scale
+    + delta;
+  e.tick = tick_;
+}
+
+
+void FlipStats::RecordFailure(branch_id_t target, branch_id_t context) {
+  tick_++;
+  num_failures_++;
+  Add(Key(target, context), 1.0, 1.0);
+  Add(BranchKey(target), 1.0, 1.0);
+}
+
+
+void FlipStats::RecordSuccess(branch_id_t target, branch_id_t context) {
+  tick_++;
+  // The flip works in this context, so forget its failures here, and
+  // give it more of a chance elsewhere.
+  Add(Key(target, context), 0.0, 0.0);
+  Add(BranchKey(target), 0.0, 0.5);
+}
+
+
+bool FlipStats::ShouldSkip(branch_id_t target, branch_id_t context) const {
+  return (Score(Key(target, context)) >= kContextSkipThreshold)
+    || (Score(BranchKey(target)) >= kBranchSkipThreshold);
+}
+
+
+unsigned FlipStats::Penalty(branch_id_t target, branch_id_t context) const {
+  return static_cast<unsigned>(Score(Key(target, context))
+                               + Score(BranchKey(target)) / 4);
+}
+
+
+void FlipStats::Save(string* s) const {
+  WriteRaw(s, tick_);
+  WriteRaw(s, static_cast<unsigned long long>(num_failures_));
+  WriteRaw(s, static_cast<unsigned long long>(stats_.size()));
+  for (StatsMap::const_iterator i = stats_.begin(); i != stats_.end(); ++i) {
+    WriteRaw(s, i->first);
+    WriteRaw(s, i->second.score);
+    WriteRaw(s, i->second.tick);
+  }
+}
+
+
+bool FlipStats::Load(istream& in) {
+  unsigned long long num_failures, n;
+  if (!ReadRaw(in, &tick_) || !ReadRaw(in, &num_failures) || !ReadRaw(in, &n))
+    return false;
+  num_failures_ = num_failures;
+  stats_.clear();
+  for (unsigned long long i = 0; i < n; i++) {
+    unsigned long long key;
+    Entry e;
+    if (!ReadRaw(in, &key) || !ReadRaw(in, &e.score) || !ReadRaw(in, &e.tick))
+      return false;
+    stats_[key] = e;
+  }
+  return true;
+}
+
+}  // namespace crest
@@ -0,0 +1,98 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_FLIP_STATS_H__
+#define RUN_CREST_FLIP_STATS_H__
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <ext/hash_map>
+
+#include "base/basic_types.h"
+#include "base/symbolic_path.h"
+
+using std::istream;
+using std::string;
+using std::vector;
+using __gnu_cxx::hash_map;
+
+namespace crest {
+
+// Statistics on failed flips -- attempts to drive an execution down the
+// other side of a branch which were unsatisfiable, or whose solution
+// did not take the predicted path.  Failures are counted per target
+// branch, and per target branch in a calling context, over the whole
+// search, so that a flip which keeps failing is skipped no matter which
+// execution it is attempted from.
+//
+// Failures decay: each one counts half as much for every kHalfLife
+// flips recorded since, so a skipped flip is eventually retried.
+//
+// Not thread-safe.
+class FlipStats {
+ public:
+  FlipStats();
+
+  // Computes, in one pass, the calling context of every element of a
+  // path: the last branch taken in the calling function before the
+  // call to the current one (or 0 at the top level).  The calls and
+  // returns of each thread are matched separately.
+  static void CallingContexts(const SymbolicPath& path,
+                              vector<branch_id_t>* contexts);
+
+  void RecordFailure(branch_id_t target, branch_id_t context);
+  void RecordSuccess(branch_id_t target, branch_id_t context);
+
+  // Should a flip to the target branch, in the given context, be
+  // skipped?
+  bool ShouldSkip(branch_id_t target, branch_id_t context) const;
+
+  // A penalty for strategies which order flips: roughly the number of
+  // recent failures of the flip.
+  unsigned Penalty(branch_id_t target, branch_id_t context) const;
+
+  size_t num_failures() const { return num_failures_; }
+  size_t size() const { return stats_.size(); }
+
+  void Save(string* s) const;
+  bool Load(istream& in);
+
+  static const unsigned kHalfLife = 1000;
+
+ private:
+  struct Entry {
+    Entry() : score(0.0), tick(0) { }
+    double score;
+    unsigned long long tick;  // When the score was last updated.
+  };
+
+  struct KeyHasher {
+    size_t operator()(unsigned long long k) const {
+      return static_cast<size_t>(k ^ (k >> 29));
+    }
+  };
+  typedef hash_map<unsigned long long, Entry, KeyHasher> StatsMap;
+
+  StatsMap stats_;
+  unsigned long long tick_;
+  size_t num_failures_;
+
+  // Per-branch entries use the key of an (impossible) context.
+  static unsigned long long Key(branch_id_t target, branch_id_t context);
+  static unsigned long long BranchKey(branch_id_t target);
+
+  double Score(unsigned long long key) const;
+  void Add(unsigned long long key, double delta, double scale);
+};
+
+}  // namespace crest
+
+#endif  // RUN_CREST_FLIP_STATS_H__
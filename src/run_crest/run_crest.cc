@@ -8,65 +8,534 @@
 // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
 // for details.
 
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <errno.h>
+#include <fstream>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "run_crest/concolic_search.h"
+#include "run_crest/shared_campaign.h"
 
-int main(int argc, char* argv[]) {
-  if (argc < 4) {
-    fprintf(stderr,
-            "Syntax: run_crest <program> "
-            "<number of iterations> "
-            "-<strategy> [strategy options]\n");
-    fprintf(stderr,
-            "  Strategies include: "
-            "dfs, cfg, random, uniform_random, random_input \n");
-    return 1;
-  }
+using std::ifstream;
+using std::max;
 
-  string prog = argv[1];
-  int num_iters = atoi(argv[2]);
-  string search_type = argv[3];
+namespace {
 
-  // Initialize the random number generator.
+// Options which apply to every strategy.
+struct GlobalOptions {
+  bool text_input;
+  int worklist_mb;
+  int cache_mb;
+  int time_budget;
+  int plateau_time;
+  int checkpoint_interval;
+  bool resume;
+  int num_workers;
+  int slice;  // Portfolio time slice, in seconds.
+  string seed_dir;
+};
+
+// The strategies run by -portfolio.
+const char* const kPortfolioStrategies[] = {
+  "-dfs", "-cfg", "-random", "-uniform_random", "-hybrid"
+};
+
+// Reads the target branches for -target: a comma-separated list of
+// branch ids, or a file of whitespace-separated branch ids.
+bool ParseTargets(const char* param, vector<crest::branch_id_t>* targets) {
+  if (param[strspn(param, "0123456789,")] == '\0') {
+    const char* p = param;
+    while (*p) {
+      if (*p != ',')
+        targets->push_back(atoi(p));
+      p += strcspn(p, ",");
+      if (*p == ',')
+        p++;
+    }
+  } else {
+    ifstream in(param);
+    if (!in)
+      return false;
+    crest::branch_id_t b;
+    while (in >> b)
+      targets->push_back(b);
+    if (!in.eof())
+      return false;
+  }
+  return !targets->empty();
+}
+
+double Now() {
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  srand((tv.tv_sec * 1000000) + tv.tv_usec);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+}  // namespace
+
+static void HandleStopSignal(int sig) {
+  crest::Search::RequestStop();
+}
 
+// Returns NULL if the strategy is unknown.  The strategy parameter,
+// if any, may be NULL.
+static crest::Search* MakeStrategy(const string& search_type,
+                                   const string& prog, int num_iters,
+                                   const char* param,
+                                   const GlobalOptions& opts) {
   crest::Search* strategy;
   if (search_type == "-random") {
     strategy = new crest::RandomSearch(prog, num_iters);
   } else if (search_type == "-random_input") {
     strategy = new crest::RandomInputSearch(prog, num_iters);
   } else if (search_type == "-dfs") {
-    if (argc == 4) {
+    if (!param) {
       strategy = new crest::BoundedDepthFirstSearch(prog, num_iters, 1000000);
     } else {
-      strategy = new crest::BoundedDepthFirstSearch(prog, num_iters, atoi(argv[4]));
+      strategy = new crest::BoundedDepthFirstSearch(prog, num_iters, atoi(param));
     }
   } else if (search_type == "-cfg") {
     strategy = new crest::CfgHeuristicSearch(prog, num_iters);
   } else if (search_type == "-cfg_baseline") {
     strategy = new crest::CfgBaselineSearch(prog, num_iters);
+  } else if (search_type == "-generational") {
+    strategy = new crest::GenerationalSearch(prog, num_iters);
+  } else if (search_type == "-target") {
+    vector<crest::branch_id_t> targets;
+    if (!param || !ParseTargets(param, &targets)) {
+      fprintf(stderr, "-target takes a list of branch ids or a file of them.\n");
+      exit(1);
+    }
+    strategy = new crest::DirectedSearch(prog, num_iters, targets);
   } else if (search_type == "-hybrid") {
     strategy = new crest::HybridSearch(prog, num_iters, 100);
   } else if (search_type == "-uniform_random") {
-    if (argc == 4) {
+    if (!param) {
       strategy = new crest::UniformRandomSearch(prog, num_iters, 100000000);
     } else {
-      strategy = new crest::UniformRandomSearch(prog, num_iters, atoi(argv[4]));
+      strategy = new crest::UniformRandomSearch(prog, num_iters, atoi(param));
     }
   } else {
-    fprintf(stderr, "Unknown search strategy: %s\n", search_type.c_str());
-    return 1;
+    return NULL;
   }
 
+  strategy->set_text_input(opts.text_input);
+  strategy->set_time_budget(opts.time_budget);
+  strategy->set_plateau_time(opts.plateau_time);
+  strategy->set_checkpoint_interval(opts.checkpoint_interval);
+  strategy->set_seeds(opts.seed_dir);
+  if (opts.cache_mb >= 0) {
+    strategy->set_max_cache_bytes(static_cast<size_t>(opts.cache_mb) << 20);
+  }
+  if (opts.worklist_mb >= 0) {
+    strategy->set_max_worklist_bytes(static_cast<size_t>(opts.worklist_mb) << 20);
+  }
+  return strategy;
+}
+
+// Runs the search to completion (in the current directory).
+static void RunSearch(crest::Search* strategy, bool resume) {
+  if (resume && !strategy->Resume("checkpoint")) {
+    fprintf(stderr, "Could not resume from checkpoint; starting over.\n");
+  }
+
+  // On SIGINT or SIGTERM, finish the current run and then stop cleanly.
+  signal(SIGINT, HandleStopSignal);
+  signal(SIGTERM, HandleStopSignal);
+
   strategy->Run();
+  strategy->Finish("search exhausted");
+}
+
+// Forks a worker process which runs the search in its own directory
+// "worker.K" (so that the files written by the program under test do
+// not collide), sharing coverage and new-coverage inputs.  The strategy
+// has already read the program's branches and CFG, so the worker does
+// not need copies of those files.
+//
+// A worker forked 'stopped' is put in its own process group (so that
+// it can be stopped and continued along with the program it is
+// running), and stops itself before it starts searching.
+static pid_t ForkWorker(crest::Search* strategy, crest::SharedCampaign* shared,
+                        int k, bool resume, bool stopped) {
+  int seed = rand();
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("Failed to fork worker");
+    return -1;
+  }
+  if (pid > 0) {
+    if (stopped) {
+      setpgid(pid, pid);
+      waitpid(pid, NULL, WUNTRACED);
+    }
+    return pid;
+  }
+
+  char dir[32];
+  snprintf(dir, sizeof(dir), "worker.%d", k);
+  if (((mkdir(dir, 0777) != 0) && (errno != EEXIST)) || (chdir(dir) != 0)) {
+    perror("Failed to enter worker directory");
+    exit(-1);
+  }
+  srand(seed);
+  shared->set_worker(k);
+  if (k > 0) {
+    // Only the first worker replays any seeds -- the others import the
+    // seeds which find new coverage.
+    strategy->set_seeds("");
+  }
+  strategy->set_shared_campaign(shared);
+  if (stopped) {
+    setpgid(0, 0);
+    raise(SIGSTOP);
+  }
+  RunSearch(strategy, resume);
+  exit(0);
+}
+
+// Makes SIGINT and SIGTERM interrupt (rather than restart) system calls
+// in the parent of a multi-process campaign.
+static void InstallParentSignalHandlers() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = HandleStopSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+}
+
+// Runs the search in several workers (see ForkWorker).
+static int RunWorkers(crest::Search* strategy, int num_workers, bool resume) {
+  crest::SharedCampaign* shared =
+    crest::SharedCampaign::Create(strategy->max_branch());
+  if (!shared)
+    return 1;
+
+  vector<pid_t> pids;
+  for (int k = 0; k < num_workers; k++) {
+    pid_t pid = ForkWorker(strategy, shared, k, resume, false);
+    if (pid == -1)
+      break;
+    pids.push_back(pid);
+  }
+
+  // Wait for the workers.  A SIGINT or SIGTERM is passed on to them.
+  InstallParentSignalHandlers();
+  bool forwarded = false;
+  size_t num_running = pids.size();
+  while (num_running > 0) {
+    if (waitpid(-1, NULL, 0) > 0) {
+      num_running--;
+    } else if (errno == EINTR) {
+      if (crest::Search::stop_requested() && !forwarded) {
+        for (size_t i = 0; i < pids.size(); i++)
+          kill(pids[i], SIGTERM);
+        forwarded = true;
+      }
+    } else {
+      break;
+    }
+  }
+
+  shared->WriteCoverage("coverage");
+  fprintf(stderr, "All %zu workers finished: covered %zu branches.\n",
+          pids.size(), shared->NumCovered());
+  return 0;
+}
+
+namespace {
+
+// A discounted UCB1 bandit: each arm's reward history decays
+// geometrically, so that allocation follows recent performance.
+class DiscountedUcb {
+ public:
+  DiscountedUcb(size_t num_arms, double discount)
+    : discount_(discount), pulls_(num_arms, 0.0), rewards_(num_arms, 0.0),
+      max_reward_(0.0) { }
+
+  // Returns the arm to play next, among those which are still enabled.
+  size_t Select(const vector<bool>& enabled) const {
+    double total = 0.0;
+    for (size_t k = 0; k < pulls_.size(); k++)
+      total += enabled[k] ? pulls_[k] : 0.0;
+
+    // Exploration is scaled by the best reward seen so far, since
+    // rewards (new branches per second) are not bounded.
+    const double scale = (max_reward_ > 0.0) ? max_reward_ : 1.0;
+    size_t best = pulls_.size();
+    double best_score = 0.0;
+    for (size_t k = 0; k < pulls_.size(); k++) {
+      if (!enabled[k])
+        continue;
+      if (pulls_[k] < 1e-9)
+        return k;  // Play every arm once.
+      double score = rewards_[k] / pulls_[k]
+        + scale * sqrt(2.0 * log(max(total, 1.0)) / pulls_[k]);
+      if ((best == pulls_.size()) || (score > best_score)) {
+        best = k;
+        best_score = score;
+      }
+    }
+    return best;
+  }
+
+  void Update(size_t arm, double reward) {
+    for (size_t k = 0; k < pulls_.size(); k++) {
+      pulls_[k] *= discount_;
+      rewards_[k] *= discount_;
+    }
+    pulls_[arm] += 1.0;
+    rewards_[arm] += reward;
+    max_reward_ = max(max_reward_, reward);
+  }
+
+ private:
+  const double discount_;
+  vector<double> pulls_;
+  vector<double> rewards_;
+  double max_reward_;
+};
+
+}  // namespace
+
+// Runs several strategies, one worker each, over shared coverage.  The
+// workers are interleaved: one at a time is continued for a time
+// slice, chosen by a bandit rewarded with the number of new branches
+// per second found in the slice.  Any time budget or plateau applies to
+// the portfolio as a whole, not to the individual workers.
+static int RunPortfolio(const vector<crest::Search*>& strategies,
+                        const vector<string>& names,
+                        const GlobalOptions& opts) {
+  crest::SharedCampaign* shared =
+    crest::SharedCampaign::Create(strategies[0]->max_branch());
+  if (!shared)
+    return 1;
+
+  const size_t n = strategies.size();
+  vector<pid_t> pids(n, -1);
+  vector<bool> alive(n, false);
+  size_t num_alive = 0;
+  for (size_t k = 0; k < n; k++) {
+    pids[k] = ForkWorker(strategies[k], shared, k, opts.resume, true);
+    if (pids[k] != -1) {
+      alive[k] = true;
+      num_alive++;
+      fprintf(stderr, "Portfolio worker %zu: %s\n", k, names[k].c_str());
+    }
+  }
+
+  InstallParentSignalHandlers();
+
+  DiscountedUcb bandit(n, 0.9);
+  vector<unsigned> slices(n, 0);
+  vector<double> run_time(n, 0.0);
+  vector<size_t> found(n, 0);
+  const double start = Now();
+  double last_new_coverage = start;
+
+  while (num_alive > 0) {
+    if (crest::Search::stop_requested())
+      break;
+    if ((opts.time_budget > 0) && (Now() - start >= opts.time_budget))
+      break;
+    if ((opts.plateau_time > 0)
+        && (Now() - last_new_coverage >= opts.plateau_time))
+      break;
+
+    const size_t k = bandit.Select(alive);
+    const size_t covered_before = shared->NumCovered();
+    const double t0 = Now();
+    kill(-pids[k], SIGCONT);
 
-  delete strategy;
+    // Let the worker run for one slice, or until it (or another
+    // worker, on being stopped earlier) exits.
+    while ((Now() - t0 < opts.slice) && alive[k]
+           && !crest::Search::stop_requested()) {
+      usleep(10000);
+      pid_t pid;
+      while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        for (size_t j = 0; j < n; j++) {
+          if ((pids[j] == pid) && alive[j]) {
+            alive[j] = false;
+            num_alive--;
+          }
+        }
+      }
+    }
+    if (alive[k])
+      kill(-pids[k], SIGSTOP);
+
+    const double elapsed = Now() - t0;
+    const size_t new_branches = shared->NumCovered() - covered_before;
+    slices[k]++;
+    run_time[k] += elapsed;
+    found[k] += new_branches;
+    if (new_branches > 0)
+      last_new_coverage = Now();
+    bandit.Update(k, new_branches / max(elapsed, 1e-3));
+  }
+
+  // Ask the remaining workers to finish cleanly.
+  for (size_t k = 0; k < n; k++) {
+    if (alive[k]) {
+      kill(-pids[k], SIGTERM);
+      kill(-pids[k], SIGCONT);
+    }
+  }
+  while (num_alive > 0) {
+    if (waitpid(-1, NULL, 0) > 0) {
+      num_alive--;
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+
+  shared->WriteCoverage("coverage");
+  fprintf(stderr, "Portfolio finished: covered %zu branches.\n",
+          shared->NumCovered());
+  for (size_t k = 0; k < n; k++) {
+    fprintf(stderr, "  %-16s %4u slices, %8.1fs, %zu new branches\n",
+            names[k].c_str() + 1, slices[k], run_time[k], found[k]);
+  }
   return 0;
 }
 
+int main(int argc, char* argv[]) {
+  // Pull out the global options, which may appear anywhere after the
+  // strategy.
+  GlobalOptions opts;
+  opts.text_input = false;
+  opts.worklist_mb = -1;
+  opts.cache_mb = -1;
+  opts.time_budget = 0;
+  opts.plateau_time = 0;
+  opts.checkpoint_interval = 0;
+  opts.resume = false;
+  opts.num_workers = 1;
+  opts.slice = 1;
+  { int j = 1;
+    for (int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      if ((i > 3) && (arg == "-text_input")) {
+        opts.text_input = true;
+      } else if ((i > 3) && (arg == "-worklist_mb") && (i + 1 < argc)) {
+        opts.worklist_mb = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-cache_mb") && (i + 1 < argc)) {
+        opts.cache_mb = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-time") && (i + 1 < argc)) {
+        opts.time_budget = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-plateau") && (i + 1 < argc)) {
+        opts.plateau_time = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-checkpoint") && (i + 1 < argc)) {
+        opts.checkpoint_interval = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-resume")) {
+        opts.resume = true;
+      } else if ((i > 3) && (arg == "-workers") && (i + 1 < argc)) {
+        opts.num_workers = atoi(argv[++i]);
+      } else if ((i > 3) && (arg == "-slice") && (i + 1 < argc)) {
+        opts.slice = max(1, atoi(argv[++i]));
+      } else if ((i > 3) && (arg == "-seeds") && (i + 1 < argc)) {
+        opts.seed_dir = argv[++i];
+      } else {
+        argv[j++] = argv[i];
+      }
+    }
+    argc = j;
+  }
 
+  if (argc < 4) {
+    fprintf(stderr,
+            "Syntax: run_crest <program> "
+            "<number of iterations> "
+            "-<strategy> [strategy options] [global options]\n");
+    fprintf(stderr,
+            "  Strategies include: "
+            "dfs, cfg, random, uniform_random, random_input, generational,\n"
+            "    target <ids|file> (directed toward the given branches),\n"
+            "    portfolio (dfs, cfg, random, uniform_random and hybrid, "
+            "interleaved)\n");
+    fprintf(stderr,
+            "  Global options include: "
+            "-text_input (write inputs as text), "
+            "-worklist_mb <n> (memory for pending executions),\n"
+            "    -cache_mb <n> (memory for executions of run inputs, "
+            "0 for no cache),\n"
+            "    -time <secs> (time budget), "
+            "-plateau <secs> (stop after secs without new coverage),\n"
+            "    -checkpoint <secs> (save a checkpoint every secs), "
+            "-resume (continue from the last checkpoint),\n"
+            "    -workers <n> (run n worker processes sharing coverage), "
+            "-slice <secs> (portfolio time slice),\n"
+            "    -seeds <dir> (start from the inputs in dir)\n");
+    return 1;
+  }
+
+  string prog = argv[1];
+  int num_iters = atoi(argv[2]);
+  string search_type = argv[3];
+  const char* param = (argc > 4) ? argv[4] : NULL;
+  const bool portfolio = (search_type == "-portfolio");
+
+  // Workers run in their own directories, so relative paths to the
+  // program and to the seeds must be made absolute.
+  if ((opts.num_workers > 1) || portfolio) {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd))) {
+      if ((prog.find('/') != string::npos) && (prog[0] != '/'))
+        prog = string(cwd) + "/" + prog;
+      if (!opts.seed_dir.empty() && (opts.seed_dir[0] != '/'))
+        opts.seed_dir = string(cwd) + "/" + opts.seed_dir;
+    }
+  }
+
+  // Initialize the random number generator.
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  srand((tv.tv_sec * 1000000) + tv.tv_usec);
+
+  if (portfolio) {
+    // The time budget and plateau are enforced by the portfolio itself:
+    // a worker's own clock keeps running while it is stopped.
+    GlobalOptions worker_opts = opts;
+    worker_opts.time_budget = 0;
+    worker_opts.plateau_time = 0;
+
+    vector<crest::Search*> strategies;
+    vector<string> names;
+    for (size_t i = 0; i < sizeof(kPortfolioStrategies) / sizeof(char*); i++) {
+      const string name = kPortfolioStrategies[i];
+      if ((name == "-cfg") && !strategies.empty()
+          && !strategies.front()->has_cfg()) {
+        fprintf(stderr, "No cfg_branches; leaving %s out of the portfolio.\n",
+                name.c_str());
+        continue;
+      }
+      names.push_back(name);
+      strategies.push_back(MakeStrategy(name, prog, num_iters,
+                                        NULL, worker_opts));
+    }
+    return RunPortfolio(strategies, names, opts);
+  }
+
+  crest::Search* strategy =
+    MakeStrategy(search_type, prog, num_iters, param, opts);
+  if (!strategy) {
+    fprintf(stderr, "Unknown search strategy: %s\n", search_type.c_str());
+    return 1;
+  }
+
+  if (opts.num_workers > 1) {
+    return RunWorkers(strategy, opts.num_workers, opts.resume);
+  }
+
+  RunSearch(strategy, opts.resume);
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "run_crest/shared_campaign.h"
+
+namespace crest {
+
+namespace {
+
+const size_t kBitsPerWord = 8 * sizeof(unsigned long);
+
+}  // namespace
+
+
+SharedCampaign* SharedCampaign::Create(branch_id_t max_branch) {
+  size_t num_words = (max_branch + kBitsPerWord - 1) / kBitsPerWord;
+
+  // Header, then bitmap, then inbox slots.
+  size_t bytes = sizeof(Header) + num_words * sizeof(unsigned long);
+  bytes = (bytes + 63) & ~static_cast<size_t>(63);
+  bytes += kInboxSlots * sizeof(Slot);
+
+  void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("Failed to create shared campaign state");
+    return NULL;
+  }
+
+  // (The anonymous mapping is zero-filled.)
+  SharedCampaign* shared = new SharedCampaign(mem, num_words);
+  shared->header_->max_branch = max_branch;
+  return shared;
+}
+
+
+SharedCampaign::SharedCampaign(void* mem, size_t num_words)
+  : num_words_(num_words), worker_(0), cursor_(0) {
+  char* p = static_cast<char*>(mem);
+  header_ = reinterpret_cast<Header*>(p);
+  bitmap_ = reinterpret_cast<volatile unsigned long*>(p + sizeof(Header));
+  size_t offset = sizeof(Header) + num_words * sizeof(unsigned long);
+  offset = (offset + 63) & ~static_cast<size_t>(63);
+  slots_ = reinterpret_cast<Slot*>(p + offset);
+}
+
+
+bool SharedCampaign::Cover(branch_id_t b) {
+  const unsigned long bit = 1UL << (b % kBitsPerWord);
+  if (bitmap_[b / kBitsPerWord] & bit)
+    return false;
+  unsigned long old = __sync_fetch_and_or(&bitmap_[b / kBitsPerWord], bit);
+  return !(old & bit);
+}
+
+
+bool SharedCampaign::IsCovered(branch_id_t b) const {
+  return (bitmap_[b / kBitsPerWord] >> (b % kBitsPerWord)) & 1;
+}
+
+
+size_t SharedCampaign::NumCovered() const {
+  size_t n = 0;
+  for (size_t i = 0; i < num_words_; i++)
+    n += __builtin_popcountl(bitmap_[i]);
+  return n;
+}
+
+
+void SharedCampaign::Publish(const vector<value_t>& input) {
+  if (input.size() > kMaxInputSize)
+    return;
+
+  unsigned long long idx = __sync_fetch_and_add(&header_->next, 1);
+  Slot* slot = &slots_[idx % kInboxSlots];
+
+  slot->seq = 0;
+  __sync_synchronize();
+  slot->worker = worker_;
+  slot->size = input.size();
+  if (!input.empty())
+    memcpy(slot->values, &input.front(), input.size() * sizeof(value_t));
+  __sync_synchronize();
+  slot->seq = idx + 1;
+}
+
+
+void SharedCampaign::Poll(vector< vector<value_t> >* inputs) {
+  const unsigned long long next = header_->next;
+
+  // Skip any inputs which have already been overwritten.
+  if (next - cursor_ > kInboxSlots)
+    cursor_ = next - kInboxSlots;
+
+  for (; cursor_ < next; cursor_++) {
+    const Slot* slot = &slots_[cursor_ % kInboxSlots];
+    unsigned long long seq = slot->seq;
+    __sync_synchronize();
+    if (seq < cursor_ + 1)
+      break;     // Still being written -- try again next time.
+    if (seq > cursor_ + 1)
+      continue;  // Overwritten.
+    if (slot->worker == worker_)
+      continue;
+
+    vector<value_t> input(slot->values, slot->values + slot->size);
+    __sync_synchronize();
+    if (slot->seq != seq)
+      continue;  // Overwritten while we were copying it.
+    inputs->push_back(input);
+  }
+}
+
+
+bool SharedCampaign::WriteCoverage(const string& file) const {
+  FILE* f = fopen(file.c_str(), "w");
+  if (!f)
+    return false;
+
+  for (branch_id_t b = 1; b < header_->max_branch; b++) {
+    if (IsCovered(b)) {
+      fprintf(f, "%d\n", b);
+    }
+  }
+
+  fclose(f);
+  return true;
+}
+
+}  // namespace crest
@@ -0,0 +1,90 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_SHARED_CAMPAIGN_H__
+#define RUN_CREST_SHARED_CAMPAIGN_H__
+
+#include <string>
+#include <vector>
+
+#include "base/basic_types.h"
+
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// State shared by the worker processes of a multi-process campaign,
+// kept in an anonymous shared memory segment which is inherited by
+// every process forked after the segment is created.
+//
+// The segment holds:
+//  - a global coverage bitmap, which workers update with atomic ORs, and
+//  - an inbox: a ring buffer of the inputs with which workers found
+//    globally new coverage.  Each worker polls the inbox for inputs
+//    published by the others.  Readers never block writers -- a slow
+//    reader simply misses inputs that have been overwritten.
+class SharedCampaign {
+ public:
+  // Returns NULL if the segment could not be created.
+  static SharedCampaign* Create(branch_id_t max_branch);
+
+  // Must be called in each worker, after it is forked.
+  void set_worker(int worker) { worker_ = worker; }
+  int worker() const { return worker_; }
+
+  // Marks a branch as covered, returning true if no worker had covered
+  // it before.
+  bool Cover(branch_id_t b);
+  bool IsCovered(branch_id_t b) const;
+  size_t NumCovered() const;
+
+  // Publishes an input to the other workers.  Inputs with more than
+  // kMaxInputSize values are not shared.
+  void Publish(const vector<value_t>& input);
+
+  // Appends the inputs published by other workers since the last call.
+  void Poll(vector< vector<value_t> >* inputs);
+
+  // Writes the global coverage, in the same format as Search.
+  bool WriteCoverage(const string& file) const;
+
+  static const size_t kMaxInputSize = 1024;
+  static const size_t kInboxSlots = 256;
+
+ private:
+  struct Header {
+    volatile unsigned long long next;  // Number of inputs ever published.
+    branch_id_t max_branch;
+  };
+
+  struct Slot {
+    // One more than the index of the input in the slot, or zero while
+    // the slot is being written.
+    volatile unsigned long long seq;
+    int worker;
+    size_t size;
+    value_t values[kMaxInputSize];
+  };
+
+  SharedCampaign(void* mem, size_t num_words);
+
+  Header* header_;
+  volatile unsigned long* bitmap_;
+  size_t num_words_;
+  Slot* slots_;
+
+  int worker_;
+  unsigned long long cursor_;
+};
+
+}  // namespace crest
+
+#endif  // RUN_CREST_SHARED_CAMPAIGN_H__
@@ -0,0 +1,204 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#include <algorithm>
+#include <assert.h>
+#include <sstream>
+
+#include "run_crest/checkpoint.h"
+#include "run_crest/worklist.h"
+
+using std::istringstream;
+using std::make_heap;
+using std::pop_heap;
+using std::push_heap;
+
+namespace crest {
+
+namespace {
+
+class MutexLock {
+ public:
+  explicit MutexLock(pthread_mutex_t* mu) : mu_(mu) { pthread_mutex_lock(mu_); }
+  ~MutexLock() { pthread_mutex_unlock(mu_); }
+ private:
+  pthread_mutex_t* mu_;
+};
+
+// Approximate per-node overhead of a std::map.
+const size_t kMapNodeBytes = 48;
+
+}  // namespace
+
+
+bool Worklist::DepthFirst(const WorkItem& a, const WorkItem& b) {
+  // Newest first.
+  return (a.seq < b.seq);
+}
+
+bool Worklist::BreadthFirst(const WorkItem& a, const WorkItem& b) {
+  // Oldest first.
+  return (a.seq > b.seq);
+}
+
+bool Worklist::HighestScore(const WorkItem& a, const WorkItem& b) {
+  // Highest score first, and then oldest first.
+  if (a.score != b.score)
+    return (a.score < b.score);
+  return (a.seq > b.seq);
+}
+
+
+Worklist::Worklist(Priority priority, size_t max_bytes)
+  : priority_(priority), max_bytes_(max_bytes),
+    bytes_(0), next_seq_(0), num_dropped_(0) {
+  pthread_mutex_init(&lock_, NULL);
+}
+
+Worklist::~Worklist() {
+  Clear();
+  pthread_mutex_destroy(&lock_);
+}
+
+
+void Worklist::Push(SymbolicExecution* ex, size_t bound, int depth,
+                    size_t score) {
+  Entry e;
+  e.item.ex = ex;
+  e.item.bound = bound;
+  e.item.depth = depth;
+  e.item.score = score;
+  e.bytes = EstimateBytes(*ex);
+
+  MutexLock l(&lock_);
+  e.item.seq = next_seq_++;
+  items_.push_back(e);
+  push_heap(items_.begin(), items_.end(), EntryComp(priority_));
+  bytes_ += e.bytes;
+
+  // Stay within the memory budget, but always keep at least the item
+  // just pushed.
+  while ((max_bytes_ > 0) && (bytes_ > max_bytes_) && (items_.size() > 1)) {
+    DropLowestPriority();
+  }
+}
+
+
+bool Worklist::Pop(WorkItem* item) {
+  MutexLock l(&lock_);
+  if (items_.empty())
+    return false;
+
+  pop_heap(items_.begin(), items_.end(), EntryComp(priority_));
+  *item = items_.back().item;
+  bytes_ -= items_.back().bytes;
+  items_.pop_back();
+  return true;
+}
+
+
+void Worklist::Clear() {
+  MutexLock l(&lock_);
+  for (size_t i = 0; i < items_.size(); i++)
+    delete items_[i].item.ex;
+  items_.clear();
+  bytes_ = 0;
+}
+
+
+void Worklist::Save(string* s, const WorkItem* in_progress) {
+  MutexLock l(&lock_);
+  size_t n = items_.size() + (in_progress ? 1 : 0);
+  WriteRaw(s, static_cast<unsigned long long>(n));
+  for (size_t i = 0; i < n; i++) {
+    const WorkItem& item = (i < items_.size()) ? items_[i].item : *in_progress;
+    WriteRaw(s, static_cast<unsigned long long>(item.bound));
+    WriteRaw(s, item.depth);
+    WriteRaw(s, static_cast<unsigned long long>(item.score));
+    WriteRaw(s, item.seq);
+    string ex;
+    item.ex->Serialize(&ex);
+    WriteString(s, ex);
+  }
+}
+
+
+bool Worklist::Load(istream& in) {
+  unsigned long long n;
+  if (!ReadRaw(in, &n))
+    return false;
+
+  MutexLock l(&lock_);
+  for (unsigned long long i = 0; i < n; i++) {
+    Entry e;
+    unsigned long long bound, score;
+    string ex;
+    if (!ReadRaw(in, &bound) || !ReadRaw(in, &e.item.depth)
+        || !ReadRaw(in, &score) || !ReadRaw(in, &e.item.seq)
+        || !ReadString(in, &ex))
+      return false;
+    e.item.bound = bound;
+    e.item.score = score;
+
+    e.item.ex = new SymbolicExecution();
+    istringstream ex_in(ex);
+    if (!e.item.ex->Parse(ex_in)) {
+      delete e.item.ex;
+      return false;
+    }
+    e.bytes = EstimateBytes(*e.item.ex);
+
+    items_.push_back(e);
+    push_heap(items_.begin(), items_.end(), EntryComp(priority_));
+    bytes_ += e.bytes;
+    if (e.item.seq >= next_seq_)
+      next_seq_ = e.item.seq + 1;
+  }
+
+  return true;
+}
+
+
+void Worklist::DropLowestPriority() {
+  // The lowest priority item is one of the heap's leaves.
+  EntryComp comp(priority_);
+  size_t worst = items_.size() / 2;
+  for (size_t i = worst + 1; i < items_.size(); i++) {
+    if (comp(items_[i], items_[worst]))
+      worst = i;
+  }
+
+  delete items_[worst].item.ex;
+  bytes_ -= items_[worst].bytes;
+  items_[worst] = items_.back();
+  items_.pop_back();
+  make_heap(items_.begin(), items_.end(), comp);
+  num_dropped_++;
+}
+
+
+size_t Worklist::EstimateBytes(const SymbolicExecution& ex) {
+  const SymbolicPath& path = ex.path();
+  size_t bytes = sizeof(SymbolicExecution);
+  bytes += path.branches().size() * sizeof(branch_id_t);
+  bytes += path.constraints_idx().size() * sizeof(size_t);
+  bytes += ex.inputs().size() * sizeof(value_t);
+  bytes += ex.vars().size() * kMapNodeBytes;
+
+  const vector<SymbolicPred*>& constraints = path.constraints();
+  for (size_t i = 0; i < constraints.size(); i++) {
+    bytes += sizeof(SymbolicPred*) + sizeof(SymbolicPred) + sizeof(SymbolicExpr);
+    bytes += constraints[i]->expr().Size() * kMapNodeBytes;
+  }
+
+  return bytes;
+}
+
+}  // namespace crest
@@ -0,0 +1,122 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+#ifndef RUN_CREST_WORKLIST_H__
+#define RUN_CREST_WORKLIST_H__
+
+#include <istream>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "base/basic_types.h"
+#include "base/symbolic_execution.h"
+
+using std::istream;
+using std::string;
+using std::vector;
+
+namespace crest {
+
+// A pending unit of search work: an execution, and the index of the
+// first of its constraints which remains to be explored.
+struct WorkItem {
+  SymbolicExecution* ex;
+  size_t bound;
+  int depth;      // Remaining depth budget, for strategies that use one.
+  size_t score;   // Strategy-defined (e.g. number of new branches).
+  unsigned long long seq;  // Order in which the item was pushed.
+};
+
+
+// A heap-allocated worklist of pending executions, used by the search
+// strategies in place of recursion on the C++ stack.
+//
+// Items are popped in the order given by a priority function, which
+// returns true if its first argument should be popped *after* its
+// second.  The worklist owns the executions of the items it holds, and
+// estimates the memory they use: if a push takes it over its memory
+// budget, the lowest priority items are dropped (and their executions
+// deleted) until it is back under budget.
+//
+// Push and Pop may be called concurrently from several threads.
+class Worklist {
+ public:
+  typedef bool (*Priority)(const WorkItem& a, const WorkItem& b);
+
+  // Some standard priority functions.
+  static bool DepthFirst(const WorkItem& a, const WorkItem& b);
+  static bool BreadthFirst(const WorkItem& a, const WorkItem& b);
+  static bool HighestScore(const WorkItem& a, const WorkItem& b);
+
+  // A max_bytes of zero means no memory budget.
+  Worklist(Priority priority, size_t max_bytes);
+  ~Worklist();
+
+  void Push(SymbolicExecution* ex, size_t bound, int depth, size_t score);
+
+  // Removes the highest priority item, returning false if the worklist
+  // is empty.  The caller takes ownership of the item's execution.
+  bool Pop(WorkItem* item);
+
+  bool empty() const { return items_.empty(); }
+  size_t size() const { return items_.size(); }
+  size_t bytes() const { return bytes_; }
+  size_t num_dropped() const { return num_dropped_; }
+
+  // Deletes all pending items.
+  void Clear();
+
+  void set_max_bytes(size_t max_bytes) { max_bytes_ = max_bytes; }
+
+  // Writes the pending items (for a checkpoint), or adds the items
+  // written by Save.  The items keep their original priority order.
+  // An item which was popped but not yet finished can be passed as
+  // in_progress, to be saved along with the pending ones.
+  void Save(string* s, const WorkItem* in_progress);
+  bool Load(istream& in);
+
+  // A rough estimate of the memory held by an execution.
+  static size_t EstimateBytes(const SymbolicExecution& ex);
+
+ private:
+  struct Entry {
+    WorkItem item;
+    size_t bytes;
+  };
+
+  struct EntryComp {
+    explicit EntryComp(Priority p) : priority(p) { }
+    bool operator()(const Entry& a, const Entry& b) const {
+      return priority(a.item, b.item);
+    }
+    Priority priority;
+  };
+
+  const Priority priority_;
+  size_t max_bytes_;
+
+  vector<Entry> items_;  // A heap, ordered by priority_.
+  size_t bytes_;
+  unsigned long long next_seq_;
+  size_t num_dropped_;
+
+  pthread_mutex_t lock_;
+
+  void DropLowestPriority();
+
+  // Not copyable.
+  Worklist(const Worklist&);
+  Worklist& operator=(const Worklist&);
+};
+
+}  // namespace crest
+
+#endif  // RUN_CREST_WORKLIST_H__
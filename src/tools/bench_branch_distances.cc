@@ -0,0 +1,127 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+// Compares incremental and full updates of the branch distances used by
+// the CFG search strategy, on a large synthetic branch CFG.
+//
+// Usage: bench_branch_distances [num_branches] [num_updates] [batch_size]
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "run_crest/branch_distances.h"
+
+using namespace crest;
+using namespace std;
+
+static double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void ToCsr(const vector< vector<branch_id_t> >& g,
+                  vector<unsigned>* offsets, vector<branch_id_t>* nbhrs) {
+  offsets->assign(1, 0);
+  for (size_t i = 0; i < g.size(); i++) {
+    nbhrs->insert(nbhrs->end(), g[i].begin(), g[i].end());
+    offsets->push_back(nbhrs->size());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int num_branches = (argc > 1) ? atoi(argv[1]) : 1000000;
+  const int num_updates = (argc > 2) ? atoi(argv[2]) : 200;
+  const int batch_size = (argc > 3) ? atoi(argv[3]) : 4;
+  srand(12345);
+
+  // Branch ids 1..num_branches.  Most edges are short and forward (as in
+  // structured code), with some long-range ones (as for calls).
+  vector<branch_id_t> branches;
+  for (int i = 1; i <= num_branches; i++)
+    branches.push_back(i);
+
+  vector< vector<branch_id_t> > cfg(num_branches + 1);
+  vector< vector<branch_id_t> > cfg_rev(num_branches + 1);
+  size_t num_edges = 0;
+  for (int i = 1; i <= num_branches; i++) {
+    int n = 1 + rand() % 3;
+    for (int k = 0; k < n; k++) {
+      int j;
+      if (rand() % 16 == 0) {
+        j = 1 + rand() % num_branches;
+      } else {
+        j = i + 1 + rand() % 8;
+      }
+      if ((j > num_branches) || (j == i))
+        continue;
+      cfg[i].push_back(j);
+      cfg_rev[j].push_back(i);
+      num_edges++;
+    }
+  }
+  printf("%d branches, %zu edges.\n", num_branches, num_edges);
+
+  // In the CSR form run_crest uses.
+  vector<unsigned> cfg_offsets, cfg_rev_offsets;
+  vector<branch_id_t> cfg_nbhrs, cfg_rev_nbhrs;
+  ToCsr(cfg, &cfg_offsets, &cfg_nbhrs);
+  ToCsr(cfg_rev, &cfg_rev_offsets, &cfg_rev_nbhrs);
+  const BranchGraph csr(&cfg_offsets.front(), &cfg_nbhrs.front(), cfg.size());
+  const BranchGraph csr_rev(&cfg_rev_offsets.front(), &cfg_rev_nbhrs.front(),
+                            cfg_rev.size());
+  const ConstArray<branch_id_t> branch_view(&branches.front(), branches.size());
+
+  BranchDistances incremental(branch_view, csr, csr_rev);
+  BranchDistances full(branch_view, csr, csr_rev);
+  vector<bool> covered(num_branches + 1, false);
+  incremental.Update(covered);
+
+  // Cover half of the branches up front, and then the rest in a random
+  // order, a small batch at a time (as a search does).
+  vector<branch_id_t> order(branches);
+  random_shuffle(order.begin(), order.end());
+  size_t next = 0;
+  for (; next < order.size() / 2; next++)
+    covered[order[next]] = true;
+  incremental.Recompute(covered);
+
+  double t_incremental = 0, t_full = 0;
+  for (int u = 0; (u < num_updates) && (next < order.size()); u++) {
+    for (int k = 0; (k < batch_size) && (next < order.size()); k++)
+      covered[order[next++]] = true;
+
+    double t0 = Now();
+    incremental.Update(covered);
+    double t1 = Now();
+    full.Recompute(covered);
+    double t2 = Now();
+    t_incremental += t1 - t0;
+    t_full += t2 - t1;
+
+    for (int i = 1; i <= num_branches; i++) {
+      if (incremental[i] != full[i]) {
+        fprintf(stderr, "Mismatch at branch %d: %zu != %zu\n",
+                i, incremental[i], full[i]);
+        return 1;
+      }
+    }
+  }
+
+  printf("Full recomputation:  %.3f ms/update\n", 1000 * t_full / num_updates);
+  printf("Incremental update:  %.3f ms/update (%.1f branches recomputed/update)\n",
+         1000 * t_incremental / num_updates,
+         double(incremental.num_nodes_recomputed())
+         / incremental.num_incremental_updates());
+  return 0;
+}
@@ -0,0 +1,163 @@
+// Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+//
+// This file is part of CREST, which is distributed under the revised
+// BSD license.  A copy of this license can be found in the file LICENSE.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+// for details.
+
+// Measures the thinning of a large synthetic CFG down to the branch
+// CFG (as done by process_cfg), serially and in parallel, and checks the
+// thinned edges of a sample of branches against a full Dijkstra search
+// from each.
+//
+// Usage: bench_thin_cfg [num_nodes] [num_checked]
+
+#include <limits>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "process_cfg/thin_cfg.h"
+
+using namespace crest;
+using namespace std;
+
+static double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// The search process_cfg used to do: Dijkstra's algorithm from src,
+// bounded at max_dist, resetting the distances of every node first.
+static void ReferenceShortestPaths(const graph_t& g, int src,
+                                   vector<size_t>& dist_map, size_t max_dist) {
+  for (size_t i = 0; i < g.size(); i++) {
+    dist_map[i] = numeric_limits<size_t>::max();
+  }
+  dist_map[src] = 0;
+
+  set< pair<size_t, int> > Q;
+  Q.insert(make_pair(0, src));
+  set<int> finished;
+
+  while (!Q.empty()) {
+    int v = Q.begin()->second;
+    size_t dist = Q.begin()->first;
+    Q.erase(Q.begin());
+    if (dist > max_dist)
+      break;
+
+    finished.insert(v);
+    for (adj_list_t::const_iterator e = g[v].begin(); e != g[v].end(); ++e) {
+      int u = e->first;
+      if (finished.find(u) == finished.end()) {
+        size_t d = dist_map[v] + e->second;
+        if ((d < dist_map[u]) && (d <= max_dist)) {
+          Q.erase(make_pair(dist_map[u], u));
+          Q.insert(make_pair(d, u));
+          dist_map[u] = d;
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int num_nodes = (argc > 1) ? atoi(argv[1]) : 4000000;
+  const int num_checked = (argc > 2) ? atoi(argv[2]) : 20;
+  srand(12345);
+
+  // About one node in four is a branch.  Most edges are short and
+  // forward (as in structured code), with some long-range ones (as for
+  // calls and returns).
+  vector<bool> is_branch(num_nodes, false);
+  vector<int> branches;
+  for (int i = 0; i < num_nodes; i++) {
+    if (rand() % 4 == 0) {
+      is_branch[i] = true;
+      branches.push_back(i);
+    }
+  }
+
+  graph_t cfg(num_nodes);
+  size_t num_edges = 0;
+  for (int i = 0; i < num_nodes; i++) {
+    int n = 1 + rand() % 2;
+    for (int k = 0; k < n; k++) {
+      int j;
+      if (rand() % 32 == 0) {
+        j = rand() % num_nodes;
+      } else {
+        j = i + 1 + rand() % 4;
+      }
+      if (j >= num_nodes)
+        continue;
+      cfg[i].push_back(make_pair(j, is_branch[j] ? 1 : 0));
+      num_edges++;
+    }
+  }
+  printf("%d nodes, %zu branches, %zu edges.\n",
+         num_nodes, branches.size(), num_edges);
+
+  // Thin the whole graph.
+  CfgThinner thinner(cfg);
+  vector<int> nbhrs;
+  size_t num_thinned_edges = 0;
+  double t0 = Now();
+  for (size_t i = 0; i < branches.size(); i++) {
+    thinner.BranchNeighbors(branches[i], is_branch, &nbhrs);
+    num_thinned_edges += nbhrs.size();
+  }
+  double t_thin = Now() - t0;
+  printf("0-1 BFS thinning:  %.3f s total (%.2f us/branch, "
+         "%.1f nodes reached/branch), %zu branch edges\n",
+         t_thin, 1e6 * t_thin / branches.size(),
+         double(thinner.num_nodes_reached()) / branches.size(),
+         num_thinned_edges);
+
+  // Thin it again, in parallel (with OMP_NUM_THREADS threads).
+  vector<string> records;
+  t0 = Now();
+  size_t num_parallel_edges = ThinBranchCfg(cfg, branches, is_branch, &records);
+  double t_parallel = Now() - t0;
+  printf("Parallel thinning: %.3f s total, %zu branch edges\n",
+         t_parallel, num_parallel_edges);
+  if (num_parallel_edges != num_thinned_edges) {
+    fprintf(stderr, "Parallel thinning found a different number of edges.\n");
+    return 1;
+  }
+
+  // Check a sample of branches against the reference search, which is
+  // far too slow to run from every branch.
+  vector<size_t> dist(num_nodes);
+  double t_ref = 0;
+  for (int k = 0; k < num_checked; k++) {
+    int src = branches[rand() % branches.size()];
+    t0 = Now();
+    ReferenceShortestPaths(cfg, src, dist, 1);
+    vector<int> expected;
+    for (size_t i = 0; i < branches.size(); i++) {
+      if (dist[branches[i]] == 1)
+        expected.push_back(branches[i]);
+    }
+    t_ref += Now() - t0;
+
+    thinner.BranchNeighbors(src, is_branch, &nbhrs);
+    if (nbhrs != expected) {
+      fprintf(stderr, "Mismatch at branch %d.\n", src);
+      return 1;
+    }
+  }
+  if (num_checked > 0) {
+    printf("Reference search:  %.2f us/branch (est. %.0f s total)\n",
+           1e6 * t_ref / num_checked,
+           t_ref / num_checked * branches.size());
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* Copyright (c) 2008, Jacob Burnim (jburnim@cs.berkeley.edu)
+ *
+ * This file is part of CREST, which is distributed under the revised
+ * BSD license.  A copy of this license can be found in the file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See LICENSE
+ * for details.
+ */
+
+#include <crest.h>
+#include <stdio.h>
+
+int main(void) {
+  unsigned char buf[6];
+  int len;
+
+  /* The whole buffer is made symbolic with a single call. */
+  CREST_array(buf);
+
+  if (buf[0] == 'C' && buf[1] == 'R') {
+    if (buf[2] == 'E' && buf[3] == 'S') {
+      len = buf[4] + buf[5];
+      if (len == 300) {
+        fprintf(stderr, "GOAL!\n");
+      }
+    }
+  }
+
+  if (buf[5] > 128) {
+    printf("high\n");
+  }
+  return 0;
+}
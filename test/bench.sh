@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Compares the running time of each test program built natively, as
+# instrumented by crestc without the inline guards in crest.h, and as
+# instrumented by crestc with the guards (the default).
+#
+# Usage: ./bench.sh [runs] [tests...]
+
+DIR=`dirname $0`
+CRESTC=${DIR}/../bin/crestc
+RUNS=${1:-1000}
+shift
+TESTS=${@:-`sed -n 's/^TESTS +*= *//p' ${DIR}/Makefile`}
+
+# Natively, the symbolic input functions just zero their arguments.
+NATIVE_INPUTS=`mktemp --suffix=.c`
+cat > ${NATIVE_INPUTS} <<EOF
+void __CrestUChar(unsigned char* x) { *x = 0; }
+void __CrestUShort(unsigned short* x) { *x = 0; }
+void __CrestUInt(unsigned int* x) { *x = 0; }
+void __CrestChar(char* x) { *x = 0; }
+void __CrestShort(short* x) { *x = 0; }
+void __CrestInt(int* x) { *x = 0; }
+void __CrestBytes(unsigned char* x, unsigned long n) {
+  while (n--) *x++ = 0;
+}
+EOF
+
+# Prints the mean time per run of the given program, in milliseconds.
+time_runs() {
+  local start=`date +%s%N`
+  for ((i = 0; i < RUNS; i++)); do
+    $1 > /dev/null 2>&1
+  done
+  local end=`date +%s%N`
+  awk "BEGIN { printf \"%.3f\", ($end - $start) / ($RUNS * 1000000) }"
+}
+
+printf "%-20s %10s %10s %10s\n" "test" "native" "unguarded" "guarded"
+for t in ${TESTS}; do
+  if ! gcc -O2 -w -I${DIR}/../include ${t}.c ${NATIVE_INPUTS} -o ${t}.native \
+     || ! ${CRESTC} ${t}.c -DCREST_NO_INLINE_GUARDS > /dev/null 2>&1 \
+     || ! mv ${t} ${t}.unguarded \
+     || ! ${CRESTC} ${t}.c > /dev/null 2>&1; then
+    echo "${t}: failed to build" >&2
+    rm -f ${t}.native ${t}.unguarded
+    continue
+  fi
+
+  rm -f input
+  printf "%-20s %10s %10s %10s\n" ${t} \
+    `time_runs ./${t}.native` `time_runs ./${t}.unguarded` `time_runs ./${t}`
+  rm -f ${t}.native ${t}.unguarded
+done
+
+rm -f ${NATIVE_INPUTS}